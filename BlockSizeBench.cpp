@@ -0,0 +1,68 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "PatienceSort.h"
+
+using namespace std;
+
+
+// best time of a few patience sorts with kBlockSize values per runblock and the memory of the blocks in use
+template <size_t kBlockSize, typename T>
+void TimeBlockSize(const vector<T>& input, int rounds) {
+    typedef PatienceSorting<typename vector<T>::iterator, std::less<T>, kBlockSize> Sorting;
+    Sorting ps;
+    ps.SetStrategy(kStrategyPatience);
+    float best = 0;
+    for(int i = 0; i < rounds; i++) {
+        vector<T> values = input;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        ps.Sort(values.begin(), values.end());
+        auto t1 = std::chrono::high_resolution_clock::now();
+        float ms = chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / 1000.0f;
+        best = (i == 0 || ms < best) ? ms : best;
+    }
+    cout << kBlockSize << "\t" << kBlockSize * sizeof(T) << "\t" << best << "\t"
+         << ps.PeakBlockUsage() * kBlockSize * sizeof(T) / (1 << 20) << (kBlockSize == DefaultBlockSize<T>::value ? "\t(default)" : "") << endl;
+}
+
+// sorted keys with a share of random values
+template <typename T>
+vector<T> AlmostSorted(size_t count, float randomness) {
+    std::mt19937 mt(count);
+    std::uniform_int_distribution<size_t> dist(0, count - 1);
+    vector<T> values(count);
+    for(size_t i = 0; i < count; i++) {
+        values[i] = static_cast<T>(i);
+    }
+    for(size_t i = 0; i < count * randomness; i++) {
+        values[dist(mt)] = static_cast<T>(dist(mt));
+    }
+    return values;
+}
+
+template <typename T>
+void SweepBlockSizes(const char* name, size_t count, float randomness, int rounds) {
+    vector<T> values = AlmostSorted<T>(count, randomness);
+    cout << "Patience Sort of " << count << " " << name << " with " << randomness * 100 << "% random values" << endl;
+    cout << "values\tbytes\tms\tpeak MiB" << endl;
+    TimeBlockSize<64>(values, rounds);
+    TimeBlockSize<128>(values, rounds);
+    TimeBlockSize<256>(values, rounds);
+    TimeBlockSize<512>(values, rounds);
+    TimeBlockSize<800>(values, rounds);
+    TimeBlockSize<1024>(values, rounds);
+    TimeBlockSize<2048>(values, rounds);
+    TimeBlockSize<4096>(values, rounds);
+    TimeBlockSize<8192>(values, rounds);
+    TimeBlockSize<16384>(values, rounds);
+    cout << endl;
+}
+
+// Sweeps the number of values per runblock, 800 is the former fixed block size
+int main() {
+    SweepBlockSizes<int>("int", 10000000, 0.1f, 3);
+    SweepBlockSizes<int>("int", 10000000, 0.01f, 3);
+    SweepBlockSizes<uint64_t>("uint64_t", 10000000, 0.1f, 3);
+    return 0;
+}
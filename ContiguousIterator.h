@@ -0,0 +1,21 @@
+#ifndef CONTIGUOUSITERATOR_H
+#define CONTIGUOUSITERATOR_H
+
+#include <vector>
+#include <iterator>
+#include <type_traits>
+
+
+// Iterators into contiguous memory, the merge kernels can write to them through a plain pointer and runs are
+// moved to them in bulk. Small inputs are sorted by the networks through a plain pointer as well. Specialize it for
+// the iterators of other contiguous containers, e.g. of a span class. std::vector<bool> packs its elements into
+// bits, so its iterators take the generic path.
+template <class RAI>
+struct IsContiguousIterator {
+    typedef typename std::iterator_traits<RAI>::value_type ValueType;
+    static const bool value = std::is_pointer<RAI>::value
+                              || (std::is_same<RAI, typename std::vector<ValueType>::iterator>::value
+                                  && !std::is_same<ValueType, bool>::value);
+};
+
+#endif
@@ -0,0 +1,329 @@
+#ifndef EXTERNALSORT_H
+#define EXTERNALSORT_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "PatienceSort.h"
+#include "LoserTree.h"
+
+
+// Out-of-core patience sort of a binary file of fixed-width records. The input is read through a memory mapping
+// in chunks that fit the memory budget, every chunk is sorted by a PatienceSorting and spilled to a temporary file
+// as one sorted run. A spilled run that starts behind the end of the previous one is
+// appended to it, so nearly sorted input ends up in few long runs. The spilled runs are merged by loser trees
+// in as many passes over the data as the fan-in needs, the last pass writes the output file.
+
+
+// I/O of the last sort, passes counts the run generation and every merge pass over the data
+struct ExternalSortStats {
+    size_t bytes_read;
+    size_t bytes_written;
+    size_t passes;
+    size_t spilled_runs;
+    size_t peak_bytes;          // most memory the sort of one chunk held, the chunk and everything its sorter kept
+
+    ExternalSortStats() : bytes_read(0), bytes_written(0), passes(0), spilled_runs(0), peak_bytes(0) { }
+};
+
+
+// A whole file mapped into memory. Files are mapped private for reading, so the merge can hand the records to
+// the loser tree as writable ranges without touching the file.
+class MappedFile {
+public:
+    MappedFile() : data_(NULL), size_(0) { }
+
+    ~MappedFile() {
+        Unmap();
+    }
+
+    MappedFile(const MappedFile&) =             delete;
+    MappedFile& operator=(const MappedFile&) =  delete;
+
+    bool MapRead(const std::string& path) {
+        Unmap();
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat info;
+        bool ok = fstat(fd, &info) == 0;
+        size_ = ok ? info.st_size : 0;
+        ok = ok && Map(fd, PROT_READ | PROT_WRITE, MAP_PRIVATE);
+        close(fd);
+        return ok;
+    }
+
+    // create or truncate the file to size bytes
+    bool MapWrite(const std::string& path, size_t size) {
+        Unmap();
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            return false;
+        }
+        size_ = size;
+        bool ok = ftruncate(fd, size) == 0 && Map(fd, PROT_READ | PROT_WRITE, MAP_SHARED);
+        close(fd);
+        return ok;
+    }
+
+    void Unmap() {
+        if(data_ != NULL) {
+            munmap(data_, size_);
+        }
+        data_ = NULL;
+        size_ = 0;
+    }
+
+    char* data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    char* data_;
+    size_t size_;
+
+    bool Map(int fd, int protection, int flags) {
+        if(size_ == 0) {
+            return true;
+        }
+        void* data = mmap(NULL, size_, protection, flags, fd, 0);
+        if(data == MAP_FAILED) {
+            return false;
+        }
+        data_ = static_cast<char*>(data);
+        madvise(data_, size_, MADV_SEQUENTIAL);
+        return true;
+    }
+};
+
+
+template <typename Record, class Compare = std::less<Record>>
+class ExternalPatienceSorting {
+    static_assert(std::is_trivially_copyable<Record>::value, "records are read and written as raw bytes");
+
+public:
+    typedef std::pair<size_t, size_t>   Run;        // first record of a spilled run and the end behind its last one
+
+    // memory_budget is the number of bytes the run generation may use, it holds one chunk, the merge buffer and
+    // the runblocks of its runs
+    explicit ExternalPatienceSorting(size_t memory_budget, Compare comp = Compare())
+            : memory_budget_(memory_budget), fan_in_(kTournamentFanIn), comp_(comp) { }
+
+    ExternalPatienceSorting(const ExternalPatienceSorting&) =               delete;
+    ExternalPatienceSorting& operator=(const ExternalPatienceSorting&) =    delete;
+
+
+    // Sort the records of input_path into output_path, returns false if a file cannot be read or written.
+    // The temporary files are placed next to the output.
+    bool Sort(const std::string& input_path, const std::string& output_path) {
+        stats_ = ExternalSortStats();
+        MappedFile input;
+        if(!input.MapRead(input_path) || input.size() % sizeof(Record) != 0) {
+            return false;
+        }
+        Record* records = reinterpret_cast<Record*>(input.data());
+        const size_t num_records = input.size() / sizeof(Record);
+        const size_t chunk = ChunkSize();
+
+        // the whole input fits into the budget
+        if(num_records <= chunk) {
+            std::vector<Record> values(records, records + num_records);
+            Sorter sorter(comp_);
+            sorter.SetNumThreads(sorter_threads_);
+            SortChunk(values, sorter);
+            stats_.passes = 1;
+            stats_.bytes_read = input.size();
+            return WriteFile(output_path, values.data(), num_records);
+        }
+
+        const std::string spill_path = output_path + ".spill";
+        std::vector<Run> runs;
+        if(!SpillRuns(records, num_records, chunk, spill_path, runs)) {
+            return false;
+        }
+        input.Unmap();
+        bool ok = MergeRuns(spill_path, output_path, runs);
+        unlink(spill_path.c_str());
+        return ok;
+    }
+
+    // number of runs merged by one loser tree, more runs are merged in several passes
+    void SetFanIn(size_t fan_in) {
+        fan_in_ = std::max<size_t>(2, fan_in);
+    }
+
+    // threads of the merge phase of every chunk
+    void SetNumThreads(size_t num_threads) {
+        sorter_threads_ = num_threads;
+    }
+
+    const ExternalSortStats& Stats() const {
+        return stats_;
+    }
+
+
+private:
+    typedef LoserTree<Record, Compare>      Tree;
+    typedef typename Tree::Range            Range;
+    typedef PatienceSorting<Record*, Compare>   Sorter;
+
+    size_t memory_budget_;
+    size_t fan_in_;
+    size_t sorter_threads_ = 1;
+    Compare comp_;
+    ExternalSortStats stats_;
+
+    // Most bytes the sort of num_records records that split into at most num_runs runs holds: the records, the merge
+    // buffer, the arena and the bookkeeping of the runs and the probe. The arena reserves blocks for twice the
+    // records and doubles when it grows, and every run keeps a partly filled block at both ends.
+    static size_t ChunkBytes(size_t num_records, size_t num_runs) {
+        const size_t block_values = DefaultBlockSize<Record>::value;
+        const size_t block_bytes = block_values * sizeof(Record) + sizeof(RunBlock<Record>);
+        const size_t blocks = num_records / block_values + 1;
+        const size_t arena = (2 * (blocks + 2 * num_runs) + kMinSlabBlocks) * block_bytes;
+        const size_t run_bytes = 2 * (2 * sizeof(Record) + sizeof(void*) + sizeof(typename Sorter::Run));
+        const size_t bookkeeping = (num_runs + static_cast<size_t>(std::sqrt(num_records)) + 1) * run_bytes;
+        return 2 * num_records * sizeof(Record) + arena + bookkeeping + 2 * kProbeSamples * sizeof(size_t);
+    }
+
+    // Records per chunk: the chunk, the merge buffer and the reserved arena take 4 times its size, the rest of the
+    // budget holds the partly filled blocks of the runs
+    size_t ChunkSize() const {
+        size_t chunk = std::max<size_t>(1, memory_budget_ / (5 * sizeof(Record)));
+        while(chunk > 1 && ChunkBytes(chunk, 1) > memory_budget_) {
+            chunk -= std::max<size_t>(1, chunk / 10);
+        }
+        return chunk;
+    }
+
+    // Sort a chunk within the budget. Run generation starts at most one run per descent, so a chunk whose descents
+    // leave the arena within the budget gets the automatic strategy. Other chunks go to the radix sort or std::sort,
+    // which need no more than the merge buffer. The sorter frees its memory afterwards.
+    void SortChunk(std::vector<Record>& values, Sorter& sorter) {
+        const size_t descents = CountDescents(values.begin(), values.end(), comp_);
+        sorter.SetStrategy(ChunkBytes(values.size(), descents + 1) <= memory_budget_ ? kStrategyAuto : kStrategyRadix);
+        sorter.Sort(values.data(), values.data() + values.size());
+        stats_.peak_bytes = std::max(stats_.peak_bytes, values.capacity() * sizeof(Record) + sorter.RetainedBytes());
+        sorter.Shrink();
+    }
+
+    // Run generation: every chunk of the input is copied into one buffer, sorted there and written behind the
+    // previous chunk in the spill file
+    bool SpillRuns(Record* records, size_t num_records, size_t chunk, const std::string& spill_path,
+                   std::vector<Run>& runs) {
+        MappedFile spill;
+        if(!spill.MapWrite(spill_path, num_records * sizeof(Record))) {
+            return false;
+        }
+        Record* out = reinterpret_cast<Record*>(spill.data());
+        Sorter sorter(comp_);
+        sorter.SetNumThreads(sorter_threads_);
+        std::vector<Record> values;
+        values.reserve(chunk);
+
+        for(size_t begin = 0; begin < num_records; begin += chunk) {
+            const size_t end = std::min(num_records, begin + chunk);
+            values.assign(records + begin, records + end);
+            SortChunk(values, sorter);
+            std::copy(values.begin(), values.end(), out + begin);
+
+            if(!runs.empty() && !comp_(out[begin], out[begin - 1])) {
+                runs.back().second = end;
+            } else {
+                runs.push_back(Run(begin, end));
+                stats_.spilled_runs++;
+            }
+        }
+        stats_.passes = 1;
+        stats_.bytes_read += num_records * sizeof(Record);
+        stats_.bytes_written += num_records * sizeof(Record);
+        return true;
+    }
+
+    // Merge passes between the spill file and a second temporary file, the last pass writes the output.
+    // A single run is already the output and only renamed.
+    bool MergeRuns(const std::string& spill_path, const std::string& output_path, std::vector<Run>& runs) {
+        std::string src_path = spill_path;
+        const std::string other_path = output_path + ".merge";
+        bool ok = true;
+        while(ok && runs.size() > 1) {
+            const bool last_pass = runs.size() <= fan_in_;
+            const std::string dst_path = last_pass ? output_path : (src_path == spill_path ? other_path : spill_path);
+            ok = MergePass(src_path, dst_path, runs);
+            src_path = dst_path;
+        }
+        if(ok && src_path != output_path) {
+            ok = rename(src_path.c_str(), output_path.c_str()) == 0;
+        }
+        unlink(other_path.c_str());
+        return ok;
+    }
+
+    // merge every group of fan_in_ runs of src_path into one run of dst_path
+    bool MergePass(const std::string& src_path, const std::string& dst_path, std::vector<Run>& runs) {
+        MappedFile src, dst;
+        if(!src.MapRead(src_path) || !dst.MapWrite(dst_path, src.size())) {
+            return false;
+        }
+        Record* in = reinterpret_cast<Record*>(src.data());
+        Record* out = reinterpret_cast<Record*>(dst.data());
+
+        std::vector<Run> merged;
+        for(size_t i = 0; i < runs.size(); i += fan_in_) {
+            std::vector<Range> group;
+            for(size_t j = i; j < std::min(i + fan_in_, runs.size()); j++) {
+                group.push_back(Range(in + runs[j].first, in + runs[j].second));
+            }
+            if(group.size() == 1) {
+                std::copy(group[0].first, group[0].second, out + runs[i].first);
+            } else {
+                Tree tree(group, comp_);
+                tree.Merge(out + runs[i].first);
+            }
+            merged.push_back(Run(runs[i].first, group.back().second - in));
+        }
+        runs.swap(merged);
+
+        stats_.passes++;
+        stats_.bytes_read += src.size();
+        stats_.bytes_written += src.size();
+        return true;
+    }
+
+    bool WriteFile(const std::string& path, const Record* records, size_t num_records) {
+        MappedFile output;
+        if(!output.MapWrite(path, num_records * sizeof(Record))) {
+            return false;
+        }
+        std::copy(records, records + num_records, reinterpret_cast<Record*>(output.data()));
+        stats_.bytes_written += num_records * sizeof(Record);
+        return true;
+    }
+};
+
+
+// sort the fixed-width records of a binary file into another file with at most memory_budget bytes of buffers
+template <typename Record>
+bool ExternalPatienceSortFunc(const std::string& input_path, const std::string& output_path, size_t memory_budget) {
+    ExternalPatienceSorting<Record> sorter(memory_budget);
+    return sorter.Sort(input_path, output_path);
+}
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef LOSERTREE_H
+#define LOSERTREE_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+
+
+// Refill of a LoserTree whose ranges are complete, see LoserTree
+struct NoRefill {
+    size_t Remaining(size_t) const {
+        return 0;
+    }
+
+    template <typename ValueType>
+    bool operator()(size_t, ValueType*&, ValueType*&) {
+        return false;
+    }
+};
+
+// Tournament tree for k-way merging. Every inner node keeps the loser of the match below it, so after
+// the winner is written only the path from its leaf to the root has to be replayed. The nodes store the
+// key of the loser next to its run index, so a match does not have to look into the runs, and the tree
+// stays cache resident for several hundred runs. Larger or non trivially copyable types are compared
+// through a pointer into their run instead. Exhausted runs lose every match and equal elements are
+// taken from the run with the lower index, so the merge is stable. The elements are moved to the output.
+// A run that is not contiguous starts with its first piece, refill(run, pos, end) sets pos and end to its next
+// piece once that is consumed and returns false at the end of the run. refill.Remaining(run) is the number of
+// elements of a run behind its first piece.
+template <typename ValueType, class Compare = std::less<ValueType>, class Refill = NoRefill>
+class LoserTree {
+public:
+    typedef std::pair<ValueType*, ValueType*>   Range;
+
+
+    explicit LoserTree(const std::vector<Range>& ranges, Compare comp = Compare(), Refill refill = Refill())
+            : comp_(comp), refill_(refill) {
+        k_ = 1;
+        while(k_ < ranges.size()) {
+            k_ *= 2;
+        }
+        cur_.assign(k_, NULL);
+        end_.assign(k_, NULL);
+        remaining_ = 0;
+        for(size_t i = 0; i < ranges.size(); i++) {
+            cur_[i] = ranges[i].first;
+            end_[i] = ranges[i].second;
+            remaining_ += ranges[i].second - ranges[i].first + refill_.Remaining(i);
+        }
+        tree_.resize(k_);
+        tree_[0] = Build(1);
+    }
+
+    // number of elements that are not merged yet
+    size_t remaining() const {
+        return remaining_;
+    }
+
+    // write the next count elements in sorted order to out
+    template <class OutIt>
+    OutIt Merge(OutIt out, size_t count) {
+        count = std::min(count, remaining_);
+        remaining_ -= count;
+
+        Node winner = tree_[0];
+        for(; count > 0; count--) {
+            *out = std::move(Value(winner.key));
+            ++out;
+            winner = Leaf(winner.run, cur_[winner.run] + 1);
+
+            // replay the matches on the path of the winner
+            for(size_t node = (winner.run + k_) / 2; node > 0; node /= 2) {
+                if(Beats(tree_[node], winner)) {
+                    std::swap(tree_[node], winner);
+                }
+            }
+        }
+        tree_[0] = winner;
+        return out;
+    }
+
+    template <class OutIt>
+    OutIt Merge(OutIt out) {
+        return Merge(out, remaining_);
+    }
+
+    // position of the next element of run in its current piece, e.g. to collect what is left after a partial merge
+    ValueType* Position(size_t run) const {
+        return cur_[run];
+    }
+
+    ValueType* PieceEnd(size_t run) const {
+        return end_[run];
+    }
+
+
+private:
+    static const bool kKeyInNode = std::is_trivially_copyable<ValueType>::value && sizeof(ValueType) <= 16;
+    typedef typename std::conditional<kKeyInNode, ValueType, ValueType*>::type Key;
+
+    struct Node {
+        Key key;
+        size_t run;
+        bool done;          // the run is exhausted, key is not valid
+    };
+
+    size_t k_;
+    size_t remaining_;
+    Compare comp_;
+    Refill refill_;
+    std::vector<ValueType*> cur_;
+    std::vector<ValueType*> end_;
+    std::vector<Node> tree_;            // tree_[0] is the overall winner, tree_[1..k_) the losers
+
+    // the element a key stands for
+    static ValueType& Value(ValueType& key) {
+        return key;
+    }
+
+    static const ValueType& Value(const ValueType& key) {
+        return key;
+    }
+
+    static ValueType& Value(ValueType* key) {
+        return *key;
+    }
+
+    static void SetKey(Node& node, ValueType* pos, std::true_type) {
+        node.key = *pos;
+    }
+
+    static void SetKey(Node& node, ValueType* pos, std::false_type) {
+        node.key = pos;
+    }
+
+    // advance run to pos and return its leaf
+    Node Leaf(size_t run, ValueType* pos) {
+        Node leaf;
+        leaf.run = run;
+        leaf.done = pos == end_[run] && !refill_(run, pos, end_[run]);
+        cur_[run] = pos;
+        if(!leaf.done) {
+            SetKey(leaf, pos, std::integral_constant<bool, kKeyInNode>());
+        }
+        return leaf;
+    }
+
+    // true if one wins against two
+    bool Beats(const Node& one, const Node& two) const {
+        if(one.done | two.done) {
+            return !one.done;
+        }
+        if(comp_(Value(two.key), Value(one.key))) {
+            return false;
+        }
+        return one.run < two.run || comp_(Value(one.key), Value(two.key));
+    }
+
+    // play all matches below node, returns the winner
+    Node Build(size_t node) {
+        if(node >= k_) {
+            return Leaf(node - k_, cur_[node - k_]);
+        }
+        Node one = Build(2 * node);
+        Node two = Build(2 * node + 1);
+        if(Beats(one, two)) {
+            tree_[node] = two;
+            return one;
+        }
+        tree_[node] = one;
+        return two;
+    }
+};
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef MEMORYPOLICY_H
+#define MEMORYPOLICY_H
+
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+#include <thread>
+#include <new>
+#include <cstddef>
+#include <cstdlib>
+#include <sys/mman.h>
+
+#ifdef PATIENCE_HAVE_NUMA
+#include <numa.h>
+#include <sched.h>
+#endif
+
+#include "MergePath.h"
+
+
+const size_t kHugePageBytes =     1 << 21;      // allocations of at least this size start at a hugepage boundary
+const size_t kPageBytes =         4096;         // prefaulting writes one byte at this distance
+
+enum HugePageMode {
+    kHugePagesOff,          // posix_memalign, transparent hugepages only if the system uses them for all memory
+    kHugePagesAdvise,       // mmap at a hugepage boundary and madvise(MADV_HUGEPAGE) for transparent hugepages
+    kHugePagesExplicit,     // MAP_HUGETLB from the reserved pool, madvise like kHugePagesAdvise if the pool is empty
+};
+
+enum NumaPlacement {
+    kNumaFirstTouch,        // on the node of the thread that writes a page first
+    kNumaInterleave,        // pages round robin over all nodes, e.g. for buffers that all threads of a merge read
+    kNumaLocal,             // bound to the node the allocating thread runs on, whichever thread writes the pages first
+};
+
+// Where the large allocations of a sorter come from: the slabs of the block arena and the merge buffers.
+// Hugepages and NUMA placement apply to allocations of at least kHugePageBytes, smaller ones are not worth it.
+// NUMA placement needs libnuma (PATIENCE_HAVE_NUMA), without it the pages are placed by first touch.
+// By default the pages of a new allocation are faulted in by the sort when it first writes them, types that are
+// trivially default constructible are not touched before. prefault_threads touch every page of a new allocation in
+// parallel instead, hugepage modes touch them with one thread if prefault_threads is 0.
+struct MemoryPolicy {
+    HugePageMode huge_pages = kHugePagesOff;
+    NumaPlacement numa = kNumaFirstTouch;
+    size_t prefault_threads = 0;
+};
+
+// true if NUMA placement is compiled in and the system supports it
+inline bool NumaSupported() {
+#ifdef PATIENCE_HAVE_NUMA
+    return numa_available() >= 0;
+#else
+    return false;
+#endif
+}
+
+// Memory of one allocation, mapped tells FreeMemory() that it came from mmap
+struct MemoryRegion {
+    void* data = NULL;
+    size_t bytes = 0;
+    bool mapped = false;
+};
+
+inline void FreeMemory(MemoryRegion& region) {
+    if(region.mapped) {
+        munmap(region.data, region.bytes);
+    } else {
+        free(region.data);
+    }
+    region = MemoryRegion();
+}
+
+// bytes mapped at a boundary of alignment, the parts in front of and behind it are unmapped again
+inline void* MapAligned(size_t bytes, size_t alignment) {
+    void* memory = mmap(NULL, bytes + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED) {
+        return NULL;
+    }
+    char* begin = static_cast<char*>(memory);
+    char* aligned = begin + (alignment - reinterpret_cast<size_t>(begin) % alignment) % alignment;
+    if(aligned > begin) {
+        munmap(begin, aligned - begin);
+    }
+    munmap(aligned + bytes, begin + alignment - aligned);
+    return aligned;
+}
+
+inline void PlaceOnNodes(void* memory, size_t bytes, NumaPlacement numa) {
+#ifdef PATIENCE_HAVE_NUMA
+    if(numa == kNumaFirstTouch || !NumaSupported()) {
+        return;
+    }
+    if(numa == kNumaInterleave) {
+        numa_interleave_memory(memory, bytes, numa_all_nodes_ptr);
+        return;
+    }
+    // numa_setlocal_memory() would place every page on the node of the thread that touches it first, e.g. a prefault
+    // thread or a thread of the parallel merge, so the pages are bound to the node of this thread instead
+    const int cpu = sched_getcpu();
+    const int node = cpu >= 0 ? numa_node_of_cpu(cpu) : -1;
+    if(node >= 0) {
+        numa_tonode_memory(memory, bytes, node);
+    } else {
+        numa_setlocal_memory(memory, bytes);
+    }
+#else
+    (void)memory;
+    (void)bytes;
+    (void)numa;
+#endif
+}
+
+// Allocate bytes at a multiple of alignment as the policy says. Nothing is touched yet, so the placement of
+// the pages is decided when they are first written. Throws std::bad_alloc if there is no memory.
+inline MemoryRegion AllocateMemory(size_t bytes, size_t alignment, const MemoryPolicy& policy) {
+    MemoryRegion region;
+    const bool place = policy.numa != kNumaFirstTouch && NumaSupported();
+    if(bytes < kHugePageBytes || (policy.huge_pages == kHugePagesOff && !place)) {
+        if(posix_memalign(&region.data, bytes >= kHugePageBytes ? std::max(alignment, kHugePageBytes) : alignment, bytes) != 0) {
+            throw std::bad_alloc();
+        }
+        region.bytes = bytes;
+        return region;
+    }
+
+    region.bytes = (bytes + kHugePageBytes - 1) / kHugePageBytes * kHugePageBytes;
+    region.mapped = true;
+#ifdef MAP_HUGETLB
+    if(policy.huge_pages == kHugePagesExplicit) {
+        region.data = mmap(NULL, region.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(region.data == MAP_FAILED) {
+            region.data = NULL;
+        }
+    }
+#endif
+    if(region.data == NULL) {
+        region.data = MapAligned(region.bytes, std::max(alignment, kHugePageBytes));
+        if(region.data == NULL) {
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        if(policy.huge_pages != kHugePagesOff) {
+            madvise(region.data, region.bytes, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    if(place) {
+        PlaceOnNodes(region.data, region.bytes, policy.numa);
+    }
+    return region;
+}
+
+// Default construct n elements at values and fault in their pages if the policy asks for it. With more than one
+// prefault thread every thread takes a part of whole hugepages.
+template <typename T>
+void ConstructElements(T* values, size_t n, const MemoryPolicy& policy) {
+    const bool trivial = std::is_trivially_default_constructible<T>::value;
+    size_t num_threads = policy.prefault_threads;
+    if(num_threads == 0 && policy.huge_pages != kHugePagesOff) {
+        num_threads = 1;
+    }
+    if(num_threads == 0) {
+        if(!trivial) {
+            for(size_t i = 0; i < n; i++) {
+                new (values + i) T;
+            }
+        }
+        return;
+    }
+    const size_t huge_pages = n * sizeof(T) / kHugePageBytes;
+    num_threads = std::max<size_t>(1, std::min(num_threads, huge_pages));
+    RunParallel(num_threads, [&](size_t t) {
+        const size_t first = n * t / num_threads;
+        const size_t last = n * (t + 1) / num_threads;
+        if(trivial) {
+            volatile char* const begin = reinterpret_cast<volatile char*>(values + first);
+            const size_t bytes = (last - first) * sizeof(T);
+            for(size_t offset = 0; offset < bytes; offset += kPageBytes) {
+                begin[offset] = 0;
+            }
+        } else {
+            for(size_t i = first; i < last; i++) {
+                new (values + i) T;
+            }
+        }
+    });
+}
+
+// Array of constructed elements in memory of a MemoryPolicy, e.g. the merge buffer of a sorter. Unlike a std::vector
+// it does not keep its elements when it grows.
+template <typename T>
+class PolicyBuffer {
+public:
+    PolicyBuffer() { }
+
+    ~PolicyBuffer() {
+        Release();
+    }
+
+    PolicyBuffer(const PolicyBuffer&) =             delete;
+    PolicyBuffer& operator=(const PolicyBuffer&) =  delete;
+
+
+    // at least n elements, newly allocated if the buffer is smaller
+    T* Resize(size_t n, const MemoryPolicy& policy) {
+        if(n > size_) {
+            Release();
+            MemoryRegion region = AllocateMemory(n * sizeof(T), alignof(T) < 64 ? 64 : alignof(T), policy);
+            ConstructElements(static_cast<T*>(region.data), n, policy);
+            region_ = region;
+            size_ = n;
+        }
+        return data();
+    }
+
+    void Release() {
+        for(size_t i = 0; i < size_; i++) {
+            data()[i].~T();
+        }
+        size_ = 0;
+        if(region_.data != NULL) {
+            FreeMemory(region_);
+        }
+    }
+
+    T* data() {
+        return static_cast<T*>(region_.data);
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    size_t Bytes() const {
+        return region_.bytes;
+    }
+
+
+private:
+    MemoryRegion region_;
+    size_t size_ = 0;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef MERGEPATH_H
+#define MERGEPATH_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+
+// Co-ranking on the merge path: returns how many elements of a are among the first k elements of the
+// merged sequence of a and b. Equal elements are taken from a first, the same way BlindMerge does it.
+template <class ItA, class ItB, class Compare>
+size_t CoRank(size_t k, ItA a, size_t size_a, ItB b, size_t size_b, Compare comp) {
+    size_t lo = k > size_b ? k - size_b : 0;
+    size_t hi = std::min(k, size_a);
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if(comp(b[k - mid], a[mid - 1])) {
+            hi = mid - 1;
+        } else {
+            lo = mid;
+        }
+    }
+    return lo;
+}
+
+// Move [first, last) to out, returns the position behind the last moved element. std::move copies trivially
+// copyable elements between pointers with memmove and into a std::deque one segment at a time.
+template <class It, class OutIt>
+OutIt MoveRange(It first, It last, OutIt out) {
+    return std::move(first, last, out);
+}
+
+const size_t kMergeMinGallop = 7;       // before this many steps the merge checks this far ahead
+
+// Galloping search in the sorted range [first, last): the probes are 1, 3, 7, ... elements away from one end,
+// then a binary search inside the last step. A position k elements away costs O(log k) comparisons.
+
+// first position whose element is greater than key, searched from first
+template <class It, class T, class Compare>
+It GallopUpper(It first, It last, const T& key, Compare comp) {
+    const size_t size = last - first;
+    size_t lo = 0;
+    size_t ofs = 1;
+    while(ofs <= size && !comp(key, first[ofs - 1])) {
+        lo = ofs;
+        ofs = 2 * ofs + 1;
+    }
+    return std::upper_bound(first + lo, first + std::min(ofs, size), key, comp);
+}
+
+// first position whose element is not less than key, searched from first
+template <class It, class T, class Compare>
+It GallopLower(It first, It last, const T& key, Compare comp) {
+    const size_t size = last - first;
+    size_t lo = 0;
+    size_t ofs = 1;
+    while(ofs <= size && comp(first[ofs - 1], key)) {
+        lo = ofs;
+        ofs = 2 * ofs + 1;
+    }
+    return std::lower_bound(first + lo, first + std::min(ofs, size), key, comp);
+}
+
+// first position whose element is not less than key, searched from last
+template <class It, class T, class Compare>
+It GallopLowerFromBack(It first, It last, const T& key, Compare comp) {
+    const size_t size = last - first;
+    size_t hi = 0;
+    size_t ofs = 1;
+    while(ofs <= size && !comp(last[-static_cast<ptrdiff_t>(ofs)], key)) {
+        hi = ofs;
+        ofs = 2 * ofs + 1;
+    }
+    return std::lower_bound(last - std::min(ofs, size), last - hi, key, comp);
+}
+
+// Merge the sorted ranges [a, a_end) and [b, b_end) to out, equal elements are taken from a first.
+// The elements are moved, out must not overlap the ranges.
+// Every kMergeMinGallop steps the merge looks that far ahead in both ranges: if one of them wins all of these
+// steps, it gallops like Timsort, the stretch that goes in front of the head of the other range is found by a
+// galloping search and moved in bulk. Unlike counting the wins of every step this costs 2 comparisons per
+// kMergeMinGallop elements when the ranges are interleaved finely.
+template <class ItA, class ItB, class OutIt, class Compare>
+OutIt MergeRanges(ItA a, ItA a_end, ItB b, ItB b_end, OutIt out, Compare comp) {
+    while(a != a_end && b != b_end) {
+        if(static_cast<size_t>(a_end - a) > kMergeMinGallop && !comp(*b, a[kMergeMinGallop - 1])) {
+            const ItA a_stop = GallopUpper(a + kMergeMinGallop, a_end, *b, comp);
+            out = MoveRange(a, a_stop, out);
+            a = a_stop;
+            continue;
+        }
+        if(static_cast<size_t>(b_end - b) > kMergeMinGallop && comp(b[kMergeMinGallop - 1], *a)) {
+            const ItB b_stop = GallopLower(b + kMergeMinGallop, b_end, *a, comp);
+            out = MoveRange(b, b_stop, out);
+            b = b_stop;
+            continue;
+        }
+        for(size_t step = 0; step < kMergeMinGallop && a != a_end && b != b_end; step++) {
+            if(comp(*b, *a)) {
+                *out = std::move(*b);
+                ++b;
+            } else {
+                *out = std::move(*a);
+                ++a;
+            }
+            ++out;
+        }
+    }
+    out = MoveRange(a, a_end, out);
+    return MoveRange(b, b_end, out);
+}
+
+// Run func(0) ... func(num_threads - 1) in parallel, the calling thread takes the first part
+template <class Func>
+void RunParallel(size_t num_threads, Func func) {
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for(size_t t = 1; t < num_threads; t++) {
+        threads.push_back(std::thread(func, t));
+    }
+    func(0);
+    for(auto& thread : threads) {
+        thread.join();
+    }
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef MERGESCHEDULE_H
+#define MERGESCHEDULE_H
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+
+// Merge order of the ping-pong merge on a flat array of run sizes. Nodes 0 ... sizes.size() - 1 are the runs,
+// the result of step j is node sizes.size() + j and the last step produces the merged output. Every merge moves
+// all elements of both nodes once, so the cost of a schedule is the sum of the sizes of all merged nodes.
+
+// One merge of the ping-pong merge, left and right are merged into the node merged
+struct MergeStep {
+    size_t left, right, merged;
+
+    MergeStep(size_t left_node, size_t right_node, size_t merged_node)
+            : left(left_node), right(right_node), merged(merged_node) { }
+};
+
+enum MergeScheduler {
+    kScheduleAuto,          // Huffman, powersort for stable sorting
+    kScheduleHuffman,       // always the two smallest nodes, the lowest cost of all merge orders
+    kSchedulePowersort,     // only neighbouring runs, keeps equal elements of different runs in order
+    kScheduleGreedy         // the former greedy order of the ping-pong merge, for comparison
+};
+
+
+// Huffman merge order: the two smallest nodes are merged first. The node with the lower index is the left one.
+inline void ScheduleHuffman(const std::vector<size_t>& sizes, std::vector<MergeStep>& steps) {
+    typedef std::pair<size_t, size_t> Node;        // size and node
+    std::priority_queue<Node, std::vector<Node>, std::greater<Node>> nodes;
+    for(size_t i = 0; i < sizes.size(); i++) {
+        nodes.push(Node(sizes[i], i));
+    }
+    size_t next_node = sizes.size();
+    while(nodes.size() > 1) {
+        Node one = nodes.top();
+        nodes.pop();
+        Node two = nodes.top();
+        nodes.pop();
+        steps.push_back(MergeStep(std::min(one.second, two.second), std::max(one.second, two.second), next_node));
+        nodes.push(Node(one.first + two.first, next_node++));
+    }
+}
+
+// Depth of the boundary between two neighbouring runs in the powersort tree: the first bit in which the relative
+// positions of their midpoints in the whole sequence differ. begin is the position of the first run.
+inline size_t NodePower(size_t begin, size_t size_one, size_t size_two, size_t num_elements) {
+    // twice the midpoints and twice the number of elements, so all values are integers
+    size_t a = 2 * begin + size_one;
+    size_t b = a + size_one + size_two;
+    const size_t n = 2 * num_elements;
+    size_t power = 0;
+    while(true) {
+        power++;
+        a *= 2;
+        b *= 2;
+        const bool bit_a = a >= n;
+        const bool bit_b = b >= n;
+        if(bit_a != bit_b) {
+            return power;
+        }
+        if(bit_a) {
+            a -= n;
+            b -= n;
+        }
+    }
+}
+
+// Powersort merge order (Munro and Wild), as in newer Timsort implementations: runs are only merged with their
+// neighbours, the boundaries are merged in the order of their depth in a nearly optimal binary tree
+inline void SchedulePowersort(const std::vector<size_t>& sizes, std::vector<MergeStep>& steps) {
+    struct Entry {
+        size_t node, begin, size, power;
+    };
+    size_t num_elements = 0;
+    for(size_t i = 0; i < sizes.size(); i++) {
+        num_elements += sizes[i];
+    }
+    if(sizes.empty()) {
+        return;
+    }
+
+    std::vector<Entry> stack;
+    Entry current = { 0, 0, sizes[0], 0 };
+    size_t next_node = sizes.size();
+    for(size_t i = 1; i < sizes.size(); i++) {
+        const size_t power = NodePower(current.begin, current.size, sizes[i], num_elements);
+        while(!stack.empty() && stack.back().power > power) {
+            steps.push_back(MergeStep(stack.back().node, current.node, next_node));
+            current = Entry{ next_node++, stack.back().begin, stack.back().size + current.size, 0 };
+            stack.pop_back();
+        }
+        current.power = power;
+        stack.push_back(current);
+        current = Entry{ i, current.begin + current.size, sizes[i], 0 };
+    }
+    while(!stack.empty()) {
+        steps.push_back(MergeStep(stack.back().node, current.node, next_node));
+        current = Entry{ next_node++, stack.back().begin, stack.back().size + current.size, 0 };
+        stack.pop_back();
+    }
+}
+
+// The greedy order the ping-pong merge used before: neighbouring nodes are merged from the front as long as the
+// pair is not larger than the first two nodes, then it starts over at the front. Only kept to compare the costs.
+inline void ScheduleGreedy(const std::vector<size_t>& sizes, std::vector<MergeStep>& steps) {
+    std::vector<std::pair<size_t, size_t>> nodes;       // node and size
+    for(size_t i = 0; i < sizes.size(); i++) {
+        nodes.push_back(std::make_pair(i, sizes[i]));
+    }
+    size_t next_node = sizes.size();
+    size_t cur = 0;
+    while(nodes.size() > 2) {
+        if(cur + 1 >= nodes.size() || nodes[cur].second + nodes[cur + 1].second > nodes[0].second + nodes[1].second) {
+            cur = 0;
+        }
+        steps.push_back(MergeStep(nodes[cur].first, nodes[cur + 1].first, next_node));
+        nodes[cur] = std::make_pair(next_node++, nodes[cur].second + nodes[cur + 1].second);
+        nodes.erase(nodes.begin() + cur + 1);
+        cur++;
+    }
+    if(nodes.size() == 2) {
+        steps.push_back(MergeStep(nodes[0].first, nodes[1].first, next_node));
+    }
+}
+
+inline void ScheduleMerges(MergeScheduler scheduler, const std::vector<size_t>& sizes, std::vector<MergeStep>& steps) {
+    steps.clear();
+    switch(scheduler) {
+        case kSchedulePowersort:
+            SchedulePowersort(sizes, steps);
+            break;
+        case kScheduleGreedy:
+            ScheduleGreedy(sizes, steps);
+            break;
+        default:
+            ScheduleHuffman(sizes, steps);
+            break;
+    }
+}
+
+// number of elements a schedule moves, the sum of the sizes of all merged nodes
+inline size_t MergeCost(const std::vector<size_t>& sizes, const std::vector<MergeStep>& steps) {
+    std::vector<size_t> node_sizes(sizes);
+    size_t cost = 0;
+    for(size_t j = 0; j < steps.size(); j++) {
+        node_sizes.push_back(node_sizes[steps[j].left] + node_sizes[steps[j].right]);
+        cost += node_sizes.back();
+    }
+    return cost;
+}
+
+#endif
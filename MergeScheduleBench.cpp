@@ -0,0 +1,109 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include "PatienceSort.h"
+
+using namespace std;
+
+
+// elements moved by a schedule per element, that is the average number of merges an element goes through
+float MovesPerElement(MergeScheduler scheduler, const vector<size_t>& sizes) {
+    vector<MergeStep> steps;
+    ScheduleMerges(scheduler, sizes, steps);
+    size_t num_elements = 0;
+    for(size_t size : sizes) {
+        num_elements += size;
+    }
+    return MergeCost(sizes, steps) / static_cast<float>(num_elements);
+}
+
+// run sizes as the run generation leaves them: the greedy order gets them sorted by size, the others in run order
+void PrintCosts(const string& name, vector<size_t> sizes) {
+    const float powersort = MovesPerElement(kSchedulePowersort, sizes);
+    const float huffman = MovesPerElement(kScheduleHuffman, sizes);
+    sort(sizes.begin(), sizes.end());
+    const float greedy = MovesPerElement(kScheduleGreedy, sizes);
+    cout << name << "\t" << sizes.size() << "\t" << greedy << "\t" << huffman << "\t" << powersort << endl;
+}
+
+float TimeSort(const vector<int>& input, MergeScheduler scheduler, int rounds) {
+    PatienceSorting<vector<int>::iterator> ps;
+    ps.SetMergeScheduler(scheduler);
+    ps.SetMergeMode(kMergePingPong);
+    ps.SetStrategy(kStrategyPatience);
+    float best = 0;
+    for(int i = 0; i < rounds; i++) {
+        vector<int> values = input;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        ps.Sort(values.begin(), values.end());
+        auto t1 = std::chrono::high_resolution_clock::now();
+        float ms = chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / 1000.0f;
+        best = (i == 0 || ms < best) ? ms : best;
+    }
+    return best;
+}
+
+// Compares the elements moved by the former greedy merge order with the Huffman and the powersort schedule for
+// several distributions of run sizes, then times the ping-pong merge with each schedule
+int main() {
+
+    const size_t count = 10000000;
+    std::mt19937 mt(1);
+
+    cout << "Elements moved per element" << endl;
+    cout << "sizes\t\truns\tgreedy\thuffman\tpowersort" << endl;
+
+    vector<size_t> equal(1000, count / 1000);
+    PrintCosts("equal\t", equal);
+
+    vector<size_t> uniform(1000);
+    std::uniform_int_distribution<size_t> dist_uniform(1, 2 * count / 1000);
+    for(size_t& size : uniform) {
+        size = dist_uniform(mt);
+    }
+    PrintCosts("uniform\t", uniform);
+
+    vector<size_t> geometric;
+    for(size_t size = count / 2; size > 0; size /= 2) {
+        geometric.push_back(size);
+    }
+    PrintCosts("geometric", geometric);
+
+    vector<size_t> zipf(1000);
+    for(size_t i = 0; i < zipf.size(); i++) {
+        zipf[i] = count / (i + 1) / 8 + 1;
+    }
+    shuffle(zipf.begin(), zipf.end(), mt);
+    PrintCosts("zipf\t", zipf);
+
+    // a long first run and many short ones, as in almost sorted input
+    vector<size_t> skewed(3000, 300);
+    skewed[0] = count - 2999 * 300;
+    PrintCosts("one long run", skewed);
+
+    vector<size_t> mixed;
+    std::exponential_distribution<double> dist_exp(1.0 / 3000);
+    for(size_t i = 0; i < 3000; i++) {
+        mixed.push_back(1 + static_cast<size_t>(dist_exp(mt)));
+    }
+    PrintCosts("exponential", mixed);
+
+
+    // sorted input with 10% random values, the runs are merged by the ping-pong merge
+    vector<int> values(count);
+    std::uniform_int_distribution<int> dist_value(0, static_cast<int>(count));
+    std::uniform_int_distribution<size_t> dist_pos(0, count - 1);
+    for(size_t i = 0; i < count; i++) {
+        values[i] = static_cast<int>(i);
+    }
+    for(size_t i = 0; i < count / 10; i++) {
+        values[dist_pos(mt)] = dist_value(mt);
+    }
+    cout << endl << "Patience Sort of " << count << " integers with 10% random values" << endl;
+    cout << "greedy " << TimeSort(values, kScheduleGreedy, 3) << " ms, huffman " << TimeSort(values, kScheduleHuffman, 3)
+         << " ms, powersort " << TimeSort(values, kSchedulePowersort, 3) << " ms" << endl;
+
+    return 0;
+}
@@ -2,317 +2,1279 @@
 #define PATIENCESORT_H
 
 #include <vector>
-#include <list>
 #include <array>
+#include <deque>
+#include <memory>
 #include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <type_traits>
+#include <functional>
+#include <limits>
+#include <cstdint>
+#include <utility>
+#include <thread>
+#include <chrono>
+#include <random>
 
 #include "RunPool.h"
+#include "MergePath.h"
+#include "LoserTree.h"
+#include "SimdMerge.h"
+#include "RunSearch.h"
+#include "SortStrategy.h"
+#include "RadixSort.h"
+#include "MergeSchedule.h"
+#include "SortStats.h"
+#include "SmallSort.h"
+#include "ContiguousIterator.h"
 
 
-const float kMaxSortedness =    0.35f;
-const float kRunPoolSize =      1.5f;
-const float kBlockPoolFactor =  15.0f;
+const size_t kMinParallelMerge = 1 << 15;      // minimum number of elements merged by one thread
+const size_t kMinParallelRuns =  1 << 16;      // minimum number of elements split into runs by one thread
+const size_t kTournamentFanIn =  1024;         // runs merged by one loser tree, the tree and the run heads fit into L2
+const size_t kMinTournamentRuns = 256;
+const float kMinTournamentPasses = 10.0f;      // passes of the pairwise merge from which on the tournament merge is used
+const size_t kSmallSortThreshold = 64;         // inputs up to this size are sorted in place without the heap
+const size_t kMinNaturalRun =     32;         // shorter natural runs are extended to this by binary insertion
+const size_t kMaxTinyRun =        8;          // patience runs up to this size are gathered and sorted before the merge
+const size_t kMaxStretchSkip =    64;         // elements that skip the stretch check after failed ones at most
+
+
+// How the merge phase combines the runs, kMergeAuto picks by the number of runs and their sizes
+enum MergeMode {
+    kMergeAuto,
+    kMergePingPong,
+    kMergeTournament
+};
+const float kBlockPoolFactor =      15.0f;
+const size_t kMaxReserveFactor =    2;          // the arena reserves at most the blocks of this many times the input
 
 
 struct RunInfo {
-    size_t array_index, elem_index, run_size;
+    size_t elem_index, run_size;
 public:
     RunInfo() { }
 
-    RunInfo(size_t arr_index, size_t el_index, size_t run_count) {
-        array_index = arr_index;
+    RunInfo(size_t el_index, size_t run_count) {
         elem_index = el_index;
         run_size = run_count;
     }
 };
 
+template <class RAI, bool = IsContiguousIterator<RAI>::value>
+struct OutputIterator {
+    typedef RAI type;
+    static type Get(RAI it) { return it; }
+};
+
 template <class RAI>
+struct OutputIterator<RAI, true> {
+    typedef typename std::iterator_traits<RAI>::value_type* type;
+    static type Get(RAI it) { return &*it; }
+};
+
+
+// lasts_ and heads_ keep copies of small trivially copyable elements, other types point to the element in its run
+template <typename ValueType, class Compare,
+          bool = std::is_trivially_copyable<ValueType>::value && sizeof(ValueType) <= 16>
+struct RunBound {
+    typedef ValueType   Type;
+    typedef Compare     Less;
+    static Type Make(const ValueType& value) { return value; }
+    static const ValueType& Get(const Type& bound) { return bound; }
+    static Less MakeLess(Compare comp) { return comp; }
+};
+
+template <typename ValueType, class Compare>
+struct RunBound<ValueType, Compare, false> {
+    typedef const ValueType*    Type;
+    struct Less {
+        Compare comp;
+        bool operator()(const ValueType* a, const ValueType* b) const { return comp(*a, *b); }
+    };
+    static Type Make(const ValueType& value) { return &value; }
+    static const ValueType& Get(const Type& bound) { return *bound; }
+    static Less MakeLess(Compare comp) { return Less{comp}; }
+};
+
+// Elements of the input are moved into the runs by Sort() and copied by CountRuns(), which keeps the input.
+// The references of std::vector<bool> are proxies returned by value, so Get() takes rvalues as well.
+template <bool kMove>
+struct InputElement {
+    template <typename T> static typename std::remove_reference<T>::type&& Get(T&& value) { return std::move(value); }
+    template <class It> static std::move_iterator<It> Range(It it) { return std::make_move_iterator(it); }
+};
+
+template <>
+struct InputElement<false> {
+    template <typename T> static const typename std::remove_reference<T>::type& Get(T&& value) { return value; }
+    template <class It> static It Range(It it) { return it; }
+};
+
+
+// All state lives in the instance, so different sorters can run on different threads at the same time.
+// A sorter itself must not be used by two threads concurrently, the same holds for a shared arena.
+// Stats is the instrumentation policy, SortStats counts the events of every call of Sort().
+template <class RAI, class Compare = std::less<typename std::iterator_traits<RAI>::value_type>,
+          size_t kBlockSize = DefaultBlockSize<typename std::iterator_traits<RAI>::value_type>::value,
+          class Stats = NoSortStats>
 class PatienceSorting {
 public:
+    template <typename, class> friend class PatienceSorter;
 
-    typedef typename RAI::value_type        ValueType;
+    typedef typename std::iterator_traits<RAI>::value_type  ValueType;
     typedef std::vector<ValueType>          ValueVector;
-    typedef std::list<RunInfo>              RunInfoList;
+    typedef PolicyBuffer<ValueType>         Buffer;
+    typedef RunPool<ValueType, kBlockSize>      Run;
+    typedef BlockArena<ValueType, kBlockSize>   Arena;
+    typedef BlockCursor<ValueType, kBlockSize>  Cursor;
 
 
-    void Sort(RAI begin, RAI end) {
-        std::vector<RunPool<ValueType>*> runs;
-        GenerateRuns(begin, end, runs);
-        Merge(begin, runs);
+    explicit PatienceSorting(Compare comp = Compare()) : comp_(comp), arena_(&own_arena_) { }
+
+    // use a caller supplied arena for the runblocks, e.g. one per worker thread that outlives the sorter
+    explicit PatienceSorting(Arena& arena, Compare comp = Compare()) : comp_(comp), arena_(&arena) { }
+
+    PatienceSorting(const PatienceSorting&) =               delete;
+    PatienceSorting& operator=(const PatienceSorting&) =    delete;
+
+
+    // Sort [begin, end), returns the stats of this call. They are empty unless the sorter has a stats policy.
+    const Stats& Sort(RAI begin, RAI end) {
+        const typename Stats::TimePoint start = stats_.Now();
+        stats_.Reset(std::max<long>(0, end - begin));
+        num_elements_ = std::distance(begin, end);
+        if (num_elements_ < 2 || static_cast<size_t>(num_elements_) <= small_sort_threshold_) {
+            strategy_ = kStrategySmall;
+            stats_.SetProbe(probe_ = DisorderProbe(), strategy_);
+            SmallSort(begin, end, comp_, stable_);
+            stats_.AddTime(kPhaseFallback, start);
+            stats_.Finish(start);
+            return stats_;
+        }
+        strategy_ = SelectStrategy(begin, end);
+        stats_.SetProbe(probe_, strategy_);
+        stats_.AddTime(kPhaseProbe, start);
+
+        const typename Stats::TimePoint sort_start = stats_.Now();
+        if (strategy_ == kStrategyFallback) {
+            FallbackSort(begin, end);
+            stats_.AddTime(kPhaseFallback, sort_start);
+        } else if (strategy_ == kStrategyRadix) {
+            RadixFallback(begin, end, std::integral_constant<bool, IsRadixSort<ValueType, Compare>::value>());
+            stats_.AddTime(kPhaseFallback, sort_start);
+        } else if (strategy_ == kStrategyNaturalMerge) {
+            NaturalMerge(begin, end, std::integral_constant<bool, IsContiguousIterator<RAI>::value>());
+        } else {
+            PatienceSort(begin, end);
+        }
+        FinishCall(start);
+        return stats_;
+    }
+
+    // Sort the smallest middle - begin elements of [begin, end) into [begin, middle) like std::partial_sort, the rest
+    // ends up in [middle, end) in no particular order. After the run generation the loser tree stops once the first
+    // part is written and the rest of the runs is moved behind it unmerged, so the merge costs O(K log runs) for
+    // K = middle - begin. Inputs the probe finds random go to std::partial_sort, unless the sorter is stable.
+    void PartialSort(RAI begin, RAI middle, RAI end) {
+        if (middle == begin || end - begin < 2) {
+            stats_.Reset(std::max<long>(0, end - begin));
+            return;
+        }
+        if (middle == end || static_cast<size_t>(end - begin) <= small_sort_threshold_) {
+            Sort(begin, end);
+            return;
+        }
+        const typename Stats::TimePoint start = ProbePartial(begin, end);
+        if (!stable_ && (strategy_ == kStrategyFallback || strategy_ == kStrategyRadix)) {
+            const typename Stats::TimePoint sort_start = stats_.Now();
+            std::partial_sort(begin, middle, end, comp_);
+            stats_.AddTime(kPhaseFallback, sort_start);
+        } else {
+            PartialMerge(begin, middle - begin, end);
+        }
+        FinishCall(start);
+    }
+
+    // Put the element that belongs to nth in sorted order there like std::nth_element, with nothing greater in front
+    // of it and nothing less behind it. The merge sorts the elements in front of nth as well, random inputs go to
+    // std::nth_element instead, unless the sorter is stable.
+    void NthElement(RAI begin, RAI nth, RAI end) {
+        if (nth == end || end - begin < 2) {
+            stats_.Reset(std::max<long>(0, end - begin));
+            return;
+        }
+        if (static_cast<size_t>(end - begin) <= small_sort_threshold_) {
+            Sort(begin, end);
+            return;
+        }
+        const typename Stats::TimePoint start = ProbePartial(begin, end);
+        if (!stable_ && (strategy_ == kStrategyFallback || strategy_ == kStrategyRadix)) {
+            const typename Stats::TimePoint sort_start = stats_.Now();
+            std::nth_element(begin, nth, end, comp_);
+            stats_.AddTime(kPhaseFallback, sort_start);
+        } else {
+            PartialMerge(begin, nth - begin + 1, end);
+        }
+        FinishCall(start);
+    }
+
+    // Run generation only, returns the number of runs the input is split into. The input is not changed.
+    size_t CountRuns(RAI begin, RAI end) {
+        if (begin == end) {
+            return 0;
+        }
+        std::vector<Run*> runs;
+        num_elements_ = std::distance(begin, end);
+        BuildRuns<false>(begin, end, runs);
+        ReleaseRuns();
+        return runs.size();
+    }
+
+    // number of threads used by the merge phase, 0 uses all cores
+    void SetNumThreads(size_t num_threads) {
+        if(num_threads == 0) {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        num_threads_ = num_threads;
+    }
+
+    void SetMergeMode(MergeMode mode) {
+        merge_mode_ = mode;
+    }
+
+    // merge order of the ping-pong merge, stable sorting uses powersort instead of the Huffman order
+    void SetMergeScheduler(MergeScheduler scheduler) {
+        scheduler_ = scheduler;
+    }
+
+    // Keep equal elements in their input order. Elements are only appended to runs and neighbouring runs
+    // are merged in the order they were created. A descending stretch that starts a run is appended to it from
+    // its end, groups of equal elements in their order, other descending input costs some speed.
+    void SetStable(bool stable) {
+        stable_ = stable;
+    }
+
+    // number of threads for the run generation, each thread splits a part of the input into runs with its
+    // own arena and all runs are merged together afterwards, 0 uses all cores
+    void SetRunGenerationThreads(size_t num_threads) {
+        if(num_threads == 0) {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        run_threads_ = num_threads;
+    }
+
+    // Force a strategy instead of choosing one from the disorder probe. The natural merge needs contiguous
+    // elements, other iterators use patience sort instead.
+    void SetStrategy(SortStrategy strategy) {
+        strategy_mode_ = strategy;
+    }
+
+    // thresholds of the automatic strategy selection, e.g. the result of CalibrateStrategy() instead of the defaults
+    void SetThresholds(const StrategyThresholds& thresholds) {
+        thresholds_ = thresholds;
+    }
+
+    // disorder measures of the input of the last call of Sort()
+    const DisorderProbe& Probe() const {
+        return probe_;
+    }
+
+    // strategy the last call of Sort() used
+    SortStrategy Strategy() const {
+        return strategy_;
+    }
+
+    // Inputs of up to threshold elements are sorted in place by SmallSort(), which allocates nothing and keeps equal
+    // elements in order if the sorter is stable. 0 sends every input through the strategy selection.
+    void SetSmallSortThreshold(size_t threshold) {
+        small_sort_threshold_ = threshold;
+    }
+
+    // The arena, the merge buffer and the run bookkeeping are kept for the next call of Sort(). If they hold more
+    // than bytes afterwards, e.g. after an unusually large input, they are freed. 0 keeps them in any case.
+    void SetHighWaterMark(size_t bytes) {
+        high_water_mark_ = bytes;
+    }
+
+    // Hugepages, NUMA placement and prefault threads of the arena and the merge buffers, applies to the memory that
+    // is allocated from now on. A caller supplied arena keeps its own policy.
+    void SetMemoryPolicy(const MemoryPolicy& policy) {
+        memory_policy_ = policy;
+        own_arena_.SetMemoryPolicy(policy);
+    }
+
+    // Free the memory kept between the calls. A caller supplied arena is left alone.
+    void Shrink() {
+        scratch_.Release();
+        std::vector<size_t>().swap(probe_samples_);
+        std::vector<typename Bound::Type>().swap(lasts_);
+        std::vector<typename Bound::Type>().swap(heads_);
+        std::vector<Run*>().swap(runs_);
+        run_pools_.clear();
+        run_pools_.shrink_to_fit();
+        num_pools_ = 0;
+        workers_.clear();
+        own_arena_.Release();
+    }
+
+    // bytes of memory kept for the next call of Sort()
+    size_t RetainedBytes() const {
+        size_t bytes = own_arena_.Bytes() + scratch_.Bytes() + probe_samples_.capacity() * sizeof(size_t)
+                       + (lasts_.capacity() + heads_.capacity()) * sizeof(typename Bound::Type)
+                       + runs_.capacity() * sizeof(Run*) + run_pools_.size() * sizeof(Run);
+        for (auto& worker : workers_) {
+            bytes += worker->RetainedBytes();
+        }
+        return bytes;
+    }
+
+    // stats of the last call of Sort(), PartialSort() or NthElement()
+    const Stats& LastStats() const {
+        return stats_;
+    }
+
+    // highest number of runblocks that were in use during one call of Sort(), summed over all run generation threads
+    size_t PeakBlockUsage() const {
+        size_t peak = arena_->PeakBlocks();
+        for (auto& worker : workers_) {
+            peak += worker->PeakBlockUsage();
+        }
+        return peak;
     }
 
 
 private:
-    std::vector<ValueType> lasts_;
-    std::vector<ValueType> heads_;
+    typedef RunBound<ValueType, Compare>    Bound;
+
+    Compare comp_;
+    std::vector<typename Bound::Type> lasts_;
+    std::vector<typename Bound::Type> heads_;
     long num_elements_ = 0;
-    size_t num_runs_ = 0;
-    float sortedness_ = 0.0f;
-    int values_not_in_order_ = 0;
+    DisorderProbe probe_;
+    StrategyThresholds thresholds_;
+    SortStrategy strategy_mode_ = kStrategyAuto;
+    SortStrategy strategy_ = kStrategyAuto;
+    size_t num_threads_ = 1;
+    size_t run_threads_ = 1;
+    MergeMode merge_mode_ = kMergeAuto;
+    MergeScheduler scheduler_ = kScheduleAuto;
+    bool stable_ = false;
+    size_t small_sort_threshold_ = kSmallSortThreshold;
+    size_t high_water_mark_ = 0;
+    MemoryPolicy memory_policy_;
+    Stats stats_;
 
-    static RunPool<ValueType>* memory_;
-    static RunPool<ValueType>* next_free_;
-    static size_t run_blocks_;
+    Arena own_arena_;
+    Arena* arena_;
+    std::deque<Run> run_pools_;      // deque keeps the runs in place when it grows, reused by the next call
+    size_t num_pools_ = 0;           // runs of run_pools_ in use
+    std::vector<Run*> runs_;
+    Buffer scratch_;                 // merge buffer, kept between the calls
+    std::vector<size_t> probe_samples_;     // indices of the samples of the inversion estimate
+    std::vector<std::unique_ptr<PatienceSorting>> workers_;        // run generation of the other threads
 
-    void GenerateRuns(RAI begin, RAI end, std::vector<RunPool<ValueType>*>& runs) {
-        runs.clear();
+    void PatienceSort(RAI begin, RAI end) {
+        std::vector<Run*>& runs = runs_;
+        const size_t allocated = AllocatedBlocks();
+        typename Stats::TimePoint start = stats_.Now();
+        GenerateRuns(begin, end, runs);
+        stats_.AddTime(kPhaseRunGeneration, start);
+        stats_.SetRuns(runs);
+
+        start = stats_.Now();
+        Merge(begin, runs);
+        stats_.AddTime(kPhaseMerge, start);
+        stats_.AddBlocks(AllocatedBlocks() - allocated);
+
+        // hand the runblocks back to the arenas for the next call and release the runs
+        ReleaseRuns();
+        for (auto& worker : workers_) {
+            worker->ReleaseRuns();
+        }
+    }
+
+    // Hands the loser tree the next block of a run once it has consumed one
+    struct CursorRefill {
+        std::vector<Run*>* runs;
+        std::vector<Cursor>* cursors;
+
+        size_t Remaining(size_t run) const {
+            const Cursor& cursor = (*cursors)[run];
+            return (*runs)[run]->size() - (cursor.end - cursor.pos);
+        }
+
+        bool operator()(size_t run, ValueType*& pos, ValueType*& end) {
+            if (run >= cursors->size()) {
+                return false;
+            }
+            Cursor& cursor = (*cursors)[run];
+            cursor.pos = pos;
+            cursor.Advance();
+            pos = cursor.pos;
+            end = cursor.end;
+            return !cursor.done();
+        }
+    };
+
+    // Reset the stats for a call of PartialSort() or NthElement() on [begin, end) and pick its strategy, returns the
+    // time the call began
+    typename Stats::TimePoint ProbePartial(RAI begin, RAI end) {
+        const typename Stats::TimePoint start = stats_.Now();
         num_elements_ = std::distance(begin, end);
-        num_runs_ = static_cast<size_t>(sqrt(num_elements_));
+        stats_.Reset(num_elements_);
+        strategy_ = SelectStrategy(begin, end);
+        stats_.SetProbe(probe_, strategy_);
+        stats_.AddTime(kPhaseProbe, start);
+        return start;
+    }
+
+    // Complete the stats of a call that began at start and free the memory it left above the high-water mark
+    void FinishCall(typename Stats::TimePoint start) {
+        stats_.Finish(start);
+        if (high_water_mark_ > 0 && RetainedBytes() > high_water_mark_) {
+            Shrink();
+        }
+    }
+
+    // Generate the runs of [begin, end), merge their first k elements into [begin, begin + k) and move the rest of
+    // every run behind them. The runs are read out of their blocks, so there is no merge buffer.
+    void PartialMerge(RAI begin, size_t k, RAI end) {
+        typedef LoserTree<ValueType, Compare, CursorRefill> Tree;
+        typedef typename Tree::Range Range;
+
+        std::vector<Run*>& runs = runs_;
+        const size_t allocated = AllocatedBlocks();
+        typename Stats::TimePoint phase_start = stats_.Now();
+        GenerateRuns(begin, end, runs);
+        stats_.AddTime(kPhaseRunGeneration, phase_start);
+        stats_.SetRuns(runs);
+
+        phase_start = stats_.Now();
+        std::vector<Cursor> cursors;
+        std::vector<Range> ranges;
+        cursors.reserve(runs.size());
+        ranges.reserve(runs.size());
+        for (Run* run : runs) {
+            cursors.push_back(Cursor(*run));
+            ranges.push_back(Range(cursors.back().pos, cursors.back().end));
+        }
+        CursorRefill refill = { &runs, &cursors };
+        Tree tree(ranges, comp_, refill);
+        auto out = tree.Merge(OutputIterator<RAI>::Get(begin), k);
+
+        for (size_t i = 0; i < cursors.size(); i++) {
+            Cursor& cursor = cursors[i];
+            cursor.pos = tree.Position(i);
+            cursor.end = tree.PieceEnd(i);
+            while (!cursor.done()) {
+                out = MoveRange(cursor.pos, cursor.end, out);
+                cursor.pos = cursor.end;
+                cursor.Advance();
+            }
+        }
+        stats_.AddTime(kPhaseMerge, phase_start);
+        stats_.AddBlocks(AllocatedBlocks() - allocated);
 
-        // calculate the degree of disorder
-        values_not_in_order_ = GetOrderLevel(begin, end);
-        sortedness_ = values_not_in_order_ / static_cast<float>(num_elements_);
+        ReleaseRuns();
+        for (auto& worker : workers_) {
+            worker->ReleaseRuns();
+        }
+    }
+
+    // Probe the disorder of the input and pick the strategy for it, unless one is forced. The inversions are only
+    // estimated if the descents do not decide the strategy on their own.
+    SortStrategy SelectStrategy(RAI begin, RAI end) {
+        const size_t num_elements = std::distance(begin, end);
+        probe_ = ProbeDescents(begin, end, comp_);
+        probe_.inversions = -1.0f;
+        if (strategy_mode_ == kStrategyAuto && NeedsInversions(probe_, thresholds_, stable_, num_elements)) {
+            ProbeInversions(begin, end, comp_, probe_samples_, probe_);
+        }
+        SortStrategy strategy = strategy_mode_ == kStrategyAuto
+                                ? ChooseStrategy(probe_, thresholds_, stable_, num_elements) : strategy_mode_;
+        // The natural merge needs contiguous iterators. Stable input with too many runs for patience sort takes the
+        // fallback instead.
+        if (strategy == kStrategyNaturalMerge && !IsContiguousIterator<RAI>::value) {
+            const bool many_runs = strategy_mode_ == kStrategyAuto && stable_ && TooManyStableRuns(probe_, num_elements);
+            strategy = many_runs ? kStrategyFallback : kStrategyPatience;
+        }
 
-        // fallback to std::sort if input data is too random
-        if(sortedness_ > kMaxSortedness) {
-            std::sort(begin, end);
+        // Integer and floating point keys fall back to the radix sort. It orders -0.0 before 0.0, so stable
+        // sorting keeps the comparison sort for floating point keys.
+        const bool radix = IsRadixSort<ValueType, Compare>::value && !(stable_ && std::is_floating_point<ValueType>::value);
+        if (strategy_mode_ == kStrategyAuto && strategy == kStrategyFallback && radix) {
+            strategy = kStrategyRadix;
+        }
+        if (strategy == kStrategyRadix && !radix) {
+            strategy = kStrategyFallback;
+        }
+        return strategy;
+    }
+
+    // comparison sort for input that is too random for the run generation
+    void FallbackSort(RAI begin, RAI end) {
+        if (stable_) {
+            std::stable_sort(begin, end, comp_);
+        } else {
+            std::sort(begin, end, comp_);
+        }
+    }
+
+    // Radix sort of the input, iterators that are not contiguous are sorted in a copy
+    void RadixFallback(RAI begin, RAI end, std::true_type) {
+        ValueType* buffer = Scratch(num_elements_);
+        Buffer copy;
+        ValueType* data = OutputBuffer(begin, copy);
+        if (!IsContiguousIterator<RAI>::value) {
+            std::copy(begin, end, data);
+        }
+        RadixSort(data, num_elements_, buffer);
+        if (!IsContiguousIterator<RAI>::value) {
+            std::copy(data, data + num_elements_, begin);
+        }
+    }
+
+    void RadixFallback(RAI begin, RAI end, std::false_type) {
+        FallbackSort(begin, end);
+    }
+
+    // Merge the runs that are already in the input without run generation: ascending stretches are runs as they
+    // are, strictly descending stretches are reversed in place, which keeps equal elements in order. The runs are
+    // merged pairwise in rounds between the input and one buffer, so the last round ends in the input. Runs shorter
+    // than kMinNaturalRun are extended by binary insertion, a round of merges is not worth a few elements.
+    void NaturalMerge(RAI begin, RAI, std::true_type) {
+        typename Stats::TimePoint phase_start = stats_.Now();
+        ValueType* data = &*begin;
+        const size_t num_elements = num_elements_;
+        std::vector<RunInfo> run_infos;
+        size_t start = 0;
+        while (start < num_elements) {
+            size_t stop = start + 1;
+            if (stop < num_elements && comp_(data[stop], data[start])) {
+                while (stop < num_elements && comp_(data[stop], data[stop - 1])) {
+                    stop++;
+                }
+                std::reverse(data + start, data + stop);
+            } else {
+                while (stop < num_elements && !comp_(data[stop], data[stop - 1])) {
+                    stop++;
+                }
+            }
+            if (stop - start < kMinNaturalRun && stop < num_elements) {
+                const size_t forced = std::min(start + kMinNaturalRun, num_elements);
+                BinaryInsertionSort(data + start, data + stop, data + forced, comp_);
+                stop = forced;
+            }
+            run_infos.push_back(RunInfo(start, stop - start));
+            start = stop;
+        }
+        stats_.AddTime(kPhaseRunGeneration, phase_start);
+        stats_.SetNaturalRuns(run_infos);
+        if (run_infos.size() < 2) {
             return;
         }
 
-        // Pool for runs
-        SetMemSize(num_runs_ * kRunPoolSize);
-        Init();
+        size_t rounds = 0;
+        for (size_t count = run_infos.size(); count > 1; count = (count + 1) / 2) {
+            rounds++;
+        }
+        phase_start = stats_.Now();
+        ValueType* src = data;
+        ValueType* dst = Scratch(num_elements);
+        if (rounds % 2 == 1) {
+            MoveRange(data, data + num_elements, dst);
+            std::swap(src, dst);
+        }
+        stats_.AddMergePasses(rounds);
+        stats_.AddMoved((rounds + rounds % 2) * num_elements * sizeof(ValueType));
 
-        // Pool for runblocks
-        RunPool<ValueType>::SetMemSize(GetMemPoolSize(num_elements_, num_runs_));
-        RunPool<ValueType>::Init();
+        const size_t num_threads = std::min(num_threads_, std::max<size_t>(1, num_elements_ / kMinParallelMerge));
+        while (run_infos.size() > 1) {
+            MergePairs(src, dst, run_infos, num_threads);
 
+            std::vector<RunInfo> merged;
+            merged.reserve((run_infos.size() + 1) / 2);
+            for (size_t i = 0; i < run_infos.size(); i += 2) {
+                RunInfo run_info = run_infos[i];
+                if (i + 1 < run_infos.size()) {
+                    run_info.run_size += run_infos[i + 1].run_size;
+                }
+                merged.push_back(run_info);
+            }
+            run_infos.swap(merged);
+            std::swap(src, dst);
+        }
+        stats_.AddTime(kPhaseMerge, phase_start);
+    }
+
+    void NaturalMerge(RAI begin, RAI end, std::false_type) {
+        PatienceSort(begin, end);
+    }
 
-        runs.reserve(num_runs_);
-        lasts_.reserve(num_elements_);
-        heads_.reserve(num_elements_);
+    void GenerateRuns(RAI begin, RAI end, std::vector<Run*>& runs) {
+        runs.clear();
 
-        for (auto it = begin; it != end; ++it) {
+        const size_t num_threads = std::min(run_threads_, std::max<size_t>(1, num_elements_ / kMinParallelRuns));
+        if(num_threads > 1) {
+            ParallelBuildRuns(begin, end, runs, num_threads);
+        } else {
+            BuildRuns(begin, end, runs);
+        }
+    }
 
-            // binary search the right run to insert the current element
-            ValueType value = *it;
-            auto key = std::lower_bound(lasts_.begin(), lasts_.end(), value, [](ValueType& v1, ValueType v2) { return v1 > v2;});
+    // Split the input into one chunk per thread and generate the runs of every chunk independently.
+    // The runs of all chunks are collected in chunk order and merged in a single merge phase.
+    void ParallelBuildRuns(RAI begin, RAI end, std::vector<Run*>& runs, size_t num_threads) {
+        while (workers_.size() < num_threads - 1) {
+            workers_.push_back(std::unique_ptr<PatienceSorting>(new PatienceSorting(comp_)));
+        }
+        for (auto& worker : workers_) {
+            worker->stable_ = stable_;
+            worker->SetMemoryPolicy(memory_policy_);
+            worker->stats_.Reset(0);
+        }
 
-            if (key != lasts_.end()) {      // if suitable run is found, append
-                size_t i = std::distance(lasts_.begin(), key);
-                runs[i]->Add(value);
-                lasts_[i] = value;
+        const size_t num_elements = std::distance(begin, end);
+        std::vector<std::vector<Run*>> chunk_runs(num_threads);
+        RunParallel(num_threads, [&](size_t t) {
+            RAI chunk_begin = begin + num_elements * t / num_threads;
+            RAI chunk_end = begin + num_elements * (t + 1) / num_threads;
+            PatienceSorting& sorter = t == 0 ? *this : *workers_[t - 1];
+            sorter.BuildRuns(chunk_begin, chunk_end, chunk_runs[t]);
+        });
 
-                // if we add to the first run, try to add as many elements as possible to avoid expensive binary search
-                if (i == 0) {
-                    auto next_value = std::next(it, 1);
-                    while (next_value != end
-                           && *next_value > lasts_[i]) {
-                        it++;
-                        runs[0]->Add(*it);
-                        lasts_[0] = *it;
-                    }
+        for (auto& chunk : chunk_runs) {
+            runs.insert(runs.end(), chunk.begin(), chunk.end());
+        }
+        for (size_t t = 1; t < num_threads; t++) {
+            stats_.AddRunGeneration(workers_[t - 1]->stats_);
+        }
+    }
+
+    // Patience run generation, splits [begin, end) into sorted runs
+    template <bool kMoveInput = true>
+    void BuildRuns(RAI begin, RAI end, std::vector<Run*>& runs) {
+        const size_t num_elements = std::distance(begin, end);
+        const size_t num_runs = static_cast<size_t>(sqrt(num_elements));
+
+        // Arena for runblocks, grows on demand if the estimate is too small. The estimate is limited to
+        // kMaxReserveFactor times the input, more is only allocated for inputs that really create that many runs.
+        arena_->Reserve(std::min(GetMemPoolSize(num_elements, num_runs), kMaxReserveFactor * (num_elements / kBlockSize + 1)));
+
+
+        // the bookkeeping grows with the runs, reserving it for one run per element would double the memory
+        runs.reserve(num_runs);
+        lasts_.clear();
+        heads_.clear();
+        lasts_.reserve(num_runs);
+        heads_.reserve(num_runs);
+        AddToRuns<kMoveInput>(begin, end, runs);
+    }
+
+    // Add the elements of [begin, end) to the runs, lasts_ and heads_ describe the runs that already exist.
+    // An element that goes to the back or the front of a run is the start of a stretch of the input that goes to
+    // the same run: the following elements as long as they keep ascending or descending and no other run would
+    // take them. Checking that costs one or two comparisons per element instead of a search, and the stretch is
+    // copied into the blocks of the run in bulk. Sawtooth and interleaved inputs consist of such stretches.
+    // In random input the check fails unpredictably, so every stretch of a single element doubles the number of
+    // elements that skip it, up to kMaxStretchSkip, like the galloping threshold of Timsort.
+    template <bool kMoveInput, class It>
+    void AddToRuns(It begin, It end, std::vector<Run*>& runs) {
+        typedef InputElement<kMoveInput> Input;
+        const typename Bound::Less less = Bound::MakeLess(comp_);
+        size_t skip = 0;
+        size_t penalty = 0;
+
+        for (It it = begin; it != end; ) {
+
+            // search the right run to insert the current element
+            const typename Bound::Type value = Bound::Make(*it);
+            size_t i = FindRunByLast(lasts_, value, less);
+
+            if (i != lasts_.size()) {       // if suitable run is found, append
+                stats_.CountAppend();
+                if (skip > 0) {
+                    skip--;
+                    lasts_[i] = Bound::Make(runs[i]->Add(Input::Get(*it)));
+                    ++it;
+                    continue;
                 }
+                It stop = AscendingStretch(it, end, i);
+                UpdateStretchSkip(std::next(it) == stop, skip, penalty);
+                runs[i]->Append(Input::Range(it), Input::Range(stop));
+                lasts_[i] = Bound::Make(runs[i]->back());
+                it = stop;
+                continue;
             }
-            else {      // no suitable run found, so we try to add the element to the begin of a run
-
-                // binary search the beginnings to find a suitable run
-                key = std::lower_bound(heads_.begin(), heads_.end(), value);
-                if (key == heads_.end()) {      // no suitable run found, create a new run and add it to sorted runs vector
-
-                    RunPool<ValueType>* run = Alloc();
-                    new(run) RunPool<ValueType>();      // necessary, otherwise the objects are not initialized -> memory error
-                    runs.push_back(run);
-
-                    runs.back()->Add(value);
-                    lasts_.push_back(value);
-                    heads_.push_back(value);
-                } else {
-                    // suitable run found, so append to its beginning.
-                    size_t i = std::distance(heads_.begin(), key);
-                    runs[i]->AddFront(value);
-                    heads_[i] = value;
+
+            // no suitable run found, so we try to add the element to the begin of a run, stable sorting only appends
+            i = stable_ ? heads_.size() : FindRunByHead(heads_, value, less);
+            if (i == heads_.size() && stable_) {
+                // Stable sorting cannot prepend, so the descending stretch that starts here is appended to a new
+                // run from its end. Groups of equal elements are appended as they are, so they keep their order.
+                runs.push_back(NewRun());
+                stats_.CountNewRun();
+                It stop = StableDescendingStretch(it, end);
+                for (It last = stop; last != it; ) {
+                    It first = std::prev(last);
+                    while (first != it && !comp_(*first, *std::prev(first))) {
+                        --first;
+                    }
+                    runs.back()->Append(Input::Range(first), Input::Range(last));
+                    last = first;
                 }
+                lasts_.push_back(Bound::Make(runs.back()->back()));
+                heads_.push_back(Bound::Make(runs.back()->front()));
+                it = stop;
+            } else if (i == heads_.size()) {       // no suitable run found, create a new run and add it to sorted runs vector
+                runs.push_back(NewRun());
+
+                const typename Bound::Type stored = Bound::Make(runs.back()->Add(Input::Get(*it)));
+                lasts_.push_back(stored);
+                heads_.push_back(stored);
+                stats_.CountNewRun();
+                ++it;
+            } else if (skip > 0) {
+                // suitable run found, so append to its beginning
+                skip--;
+                heads_[i] = Bound::Make(runs[i]->AddFront(Input::Get(*it)));
+                stats_.CountPrepend();
+                ++it;
+            } else {
+                // the same with the descending stretch that starts here
+                stats_.CountPrepend();
+                It stop = DescendingStretch(it, end, i);
+                UpdateStretchSkip(std::next(it) == stop, skip, penalty);
+                runs[i]->Prepend(Input::Range(it), Input::Range(stop));
+                heads_[i] = Bound::Make(runs[i]->front());
+                it = stop;
+            }
+        }
+    }
+
+    static void UpdateStretchSkip(bool single, size_t& skip, size_t& penalty) {
+        penalty = single ? std::min(2 * penalty + 1, kMaxStretchSkip) : 0;
+        skip = penalty;
+    }
+
+    // End of the ascending stretch from it that FindRunByLast() would append to run i element by element: run i
+    // stays the first one whose last element is not greater, so every element is less than the last one of run i - 1
+    template <class It>
+    It AscendingStretch(It it, It end, size_t i) {
+        It stop = std::next(it);
+        if (i == 0) {
+            while (stop != end && !comp_(*stop, *it)) {
+                ++it;
+                ++stop;
+                stats_.CountFirstRunHit();
+            }
+        } else {
+            const ValueType& bound = Bound::Get(lasts_[i - 1]);
+            while (stop != end && !comp_(*stop, *it) && comp_(*stop, bound)) {
+                ++it;
+                ++stop;
+                stats_.CountAppend();
             }
         }
+        return stop;
     }
 
-    void Merge(RAI begin, std::vector<RunPool<ValueType>*>& runs) {
+    // End of the descending stretch from it that FindRunByHead() would prepend to run i element by element: no run
+    // takes the elements at its back and the head of run i - 1 stays less than every element
+    template <class It>
+    It DescendingStretch(It it, It end, size_t i) {
+        It stop = std::next(it);
+        const ValueType& smallest_last = Bound::Get(lasts_.back());
+        while (stop != end && !comp_(*it, *stop) && comp_(*stop, smallest_last)
+               && (i == 0 || comp_(Bound::Get(heads_[i - 1]), *stop))) {
+            ++it;
+            ++stop;
+            stats_.CountPrepend();
+        }
+        return stop;
+    }
+
+    // End of the descending stretch from it that stable sorting puts into one new run: every element is less than
+    // the last one of all runs if the first one is, and the run would take the elements equal to their predecessor
+    template <class It>
+    It StableDescendingStretch(It it, It end) {
+        It stop = std::next(it);
+        while (stop != end && !comp_(*it, *stop)) {
+            ++it;
+            ++stop;
+            stats_.CountAppend();
+        }
+        return stop;
+    }
+
+    void Merge(RAI begin, std::vector<Run*>& runs) {
         // if no runs exist, input is probably empty, so exit here
         if(runs.size() == 0) {
             return;
         }
+        GatherTinyRuns(runs);
 
         // if only 1 run exists, this means the input data is in ascending order or in reversed, but
         // by adding to the front of a run it is automatically reversed
         if (runs.size() < 2) {
-            // copy content to target array
-            auto end = runs[0]->last();
-            auto first_copy = begin;
-            for(auto it = runs[0]->begin(); it != end; ++it) {
-                *first_copy = *it;
-                first_copy++;
-            }
-            *first_copy = runs[0]->back();
+            // move content to target array
+            MoveRun(runs[0], OutputIterator<RAI>::Get(begin));
+            FreeBlocks(runs[0]);
+            stats_.AddMergePasses(1);
+            stats_.AddMoved(num_elements_ * sizeof(ValueType));
             return;
         }
 
+        const size_t num_threads = std::min(num_threads_, std::max<size_t>(1, num_elements_ / kMinParallelMerge));
+        if(num_threads > 1) {
+            ParallelMerge(begin, runs, num_threads);
+            return;
+        }
 
-        std::sort(runs.begin(), runs.end(), [](const RunPool<ValueType>* a, const RunPool<ValueType>* b) { return
-                a->size() <
-                b->size(); });
-        ValueVector elems1;
-        ValueVector elems2(num_elements_);
-        elems1.reserve(num_elements_);
-        RunInfoList run_infos;
-        size_t next_empty_arr_loc = 0;
-        std::array<ValueVector *, 2> arrs;
-        arrs[0] = &elems1;
-        arrs[1] = &elems2;
+        // many runs that would need a lot of pairwise passes are merged in one pass by the loser tree
+        if(merge_mode_ == kMergeTournament
+           || (merge_mode_ == kMergeAuto && runs.size() >= kMinTournamentRuns
+               && PairwiseMergePasses(runs) >= kMinTournamentPasses)) {
+            TournamentMerge(begin, runs);
+            return;
+        }
 
-        // copy sorted runs consecutively to the first ping-pong array and save the information
-        // in which array it is, at which index it starts and its size to an additional list element
-        for (size_t i = 0; i < runs.size(); i++) {
+        PingPongMerge(begin, runs);
+    }
+
+    // Runs of up to kMaxTinyRun elements would each cost a merge of its own. They are moved into groups of up to
+    // the small sort threshold that fit into one block and every group is sorted there by SmallSort(), the sorting
+    // networks for arithmetic keys. Stable sorting only gathers neighbouring runs, so the binary insertion keeps
+    // equal elements of different runs in run order like the merges would.
+    void GatherTinyRuns(std::vector<Run*>& runs) {
+        const size_t max_group = std::min(small_sort_threshold_, kBlockSize);
+        size_t num_tiny = 0;
+        for (size_t i = 0; i < runs.size() && num_tiny < 2; i++) {
+            num_tiny += runs[i]->size() <= kMaxTinyRun;
+        }
+        if (max_group <= kMaxTinyRun || num_tiny < 2) {
+            return;
+        }
+        std::vector<Run*> kept;
+        std::vector<Run*> group;
+        size_t group_size = 0;
+        kept.reserve(runs.size());
+        for (Run* run : runs) {
+            const size_t size = run->size();
+            if (size > kMaxTinyRun) {
+                if (stable_) {
+                    FlushTinyRuns(group, group_size, kept);
+                }
+                kept.push_back(run);
+                continue;
+            }
+            if (group_size + size > max_group) {
+                FlushTinyRuns(group, group_size, kept);
+            }
+            group.push_back(run);
+            group_size += size;
+        }
+        FlushTinyRuns(group, group_size, kept);
+        runs.swap(kept);
+    }
 
-            size_t temp_index = next_empty_arr_loc;
-            auto it = runs[i]->begin();
-            auto end = runs[i]->last();
-            for(; it != end; ++it) {
-                elems1.push_back(*it);
-                temp_index++;
+    // Replace the runs of a group by one sorted run, a group of one run stays as it is
+    void FlushTinyRuns(std::vector<Run*>& group, size_t& group_size, std::vector<Run*>& kept) {
+        if (group.size() == 1) {
+            kept.push_back(group[0]);
+        } else if (group.size() > 1) {
+            Run* gathered = NewRun();
+            for (Run* run : group) {
+                for (RunBlock<ValueType, kBlockSize>* block = run->first_block(); block != NULL; block = block->next) {
+                    gathered->Append(std::make_move_iterator(Run::block_begin(block)),
+                                     std::make_move_iterator(Run::block_end(block)));
+                }
+                FreeBlocks(run);
             }
-            elems1.push_back(*it);
+            ValueType* first = Run::block_begin(gathered->first_block());
+            SmallSort(first, first + group_size, comp_, stable_);
+            kept.push_back(gathered);
+        }
+        group.clear();
+        group_size = 0;
+    }
 
-            RunInfo run_info;
-            run_info.array_index = 0;
-            run_info.elem_index = next_empty_arr_loc;
-            run_info.run_size = runs[i]->size();
-            run_infos.push_back(run_info);
-            next_empty_arr_loc += runs[i]->size();
+    // Ping-pong merge in the order of the merge scheduler. The merge order is planned first, so every merged run
+    // can be placed in the buffer from which the number of merges above it leads into the output. The output
+    // range is one of the two ping-pong buffers and the result of the last merge lands in it without an extra pass.
+    void PingPongMerge(RAI begin, std::vector<Run*>& runs) {
+        const MergeScheduler scheduler = Scheduler();
+        if (scheduler == kScheduleGreedy) {
+            SortRunsBySize(runs);
         }
 
-        auto cur_run = run_infos.begin();
-        const auto beginRun = cur_run;
+        // nodes 0 ... runs.size() - 1 are the runs, the result of step j is node runs.size() + j
+        std::vector<MergeStep> steps;
+        std::vector<size_t> sizes(runs.size());
+        for (size_t i = 0; i < runs.size(); i++) {
+            sizes[i] = runs[i]->size();
+        }
+        ScheduleMerges(scheduler, sizes, steps);
 
-        // Ping-pong merge until only 2 runs are left
-        while (run_infos.size() > 2) {
-            auto next_run = std::next(cur_run, 1);
-            if (cur_run == run_infos.end() || std::next(cur_run, 1) == run_infos.end() ||
-                (cur_run->run_size + next_run->run_size) >
-                (beginRun->run_size + (std::next(beginRun, 1)->run_size))) {
-                cur_run = run_infos.begin();
-            }
-            next_run = std::next(cur_run, 1);
-            if (cur_run->array_index == 0) {          // blindly merge curRun and curRuns next into Elems2
-                BlindMerge(arrs, elems2, cur_run, 1);
+        // A merged node takes the part of its parent's range in front of or behind its sibling, so nodes that
+        // exist at the same time never overlap. Children are in the other buffer than their parent.
+        const size_t num_nodes = runs.size() + steps.size();
+        std::vector<size_t> depth(num_nodes, 0);
+        std::vector<size_t> offset(num_nodes, 0);
+        sizes.resize(num_nodes);
+        for (size_t j = 0; j < steps.size(); j++) {
+            sizes[runs.size() + j] = sizes[steps[j].left] + sizes[steps[j].right];
+        }
+        for (size_t j = steps.size(); j-- > 0; ) {
+            const size_t node = runs.size() + j;
+            depth[steps[j].left] = depth[steps[j].right] = depth[node] + 1;
+            offset[steps[j].left] = offset[node];
+            offset[steps[j].right] = offset[node] + sizes[steps[j].left];
+        }
+        if (Stats::kEnabled) {
+            stats_.AddMergePasses(*std::max_element(depth.begin(), depth.begin() + runs.size()));
+            stats_.AddMoved(MergeCost(std::vector<size_t>(sizes.begin(), sizes.begin() + runs.size()), steps) * sizeof(ValueType));
+        }
+
+        // Merged nodes with an even depth are in the first buffer, with an odd depth in the second one, the root
+        // is the output. The runs are read straight out of their blocks.
+        bool needed[2] = { false, false };
+        for (size_t node = runs.size(); node + 1 < num_nodes; node++) {
+            needed[depth[node] % 2] = true;
+        }
+        Buffer first;
+        ValueType* buffers[2] = { needed[0] ? OutputBuffer(begin, first) : NULL, needed[1] ? Scratch(num_elements_) : NULL };
+
+        for (size_t j = 0; j < steps.size(); j++) {
+            const size_t node = runs.size() + j;
+            Cursor one = Source(runs, buffers, steps[j].left, offset[steps[j].left], sizes[steps[j].left], depth);
+            Cursor two = Source(runs, buffers, steps[j].right, offset[steps[j].right], sizes[steps[j].right], depth);
+            if (node + 1 == num_nodes) {
+                MergeCursors(one, two, OutputIterator<RAI>::Get(begin));
             } else {
-                BlindMerge(arrs, elems1, cur_run, 0);
+                MergeCursors(one, two, buffers[depth[node] % 2] + offset[node]);
             }
-            cur_run->run_size += next_run->run_size;
-            run_infos.erase(next_run);
-            cur_run++;
         }
+    }
 
-        // merge the last 2 runs directly to the output
-        cur_run = run_infos.begin();
-        BlindMerge(arrs, begin, cur_run);
+    // The elements of a node of the ping-pong merge: the blocks of a run or the range of a merged node
+    Cursor Source(std::vector<Run*>& runs, ValueType* buffers[2], size_t node,
+                                  size_t offset, size_t size, const std::vector<size_t>& depth) {
+        if (node < runs.size()) {
+            return Cursor(*runs[node]);
+        }
+        ValueType* first = buffers[depth[node] % 2] + offset;
+        return Cursor(first, first + size);
+    }
 
-        // release pool memory of runs and runblocks
-        RunPool<ValueType>::Release();
-        Release();
+    // Merge two runs that may be split into blocks. Each step takes the rest of the current block of the run with
+    // the smaller last element and the part of the other block in front of that element, so the merge kernels
+    // only see contiguous pieces. Equal elements are taken from one first.
+    template <class OutIt>
+    OutIt MergeCursors(Cursor& one, Cursor& two, OutIt out) {
+        while (!one.done() && !two.done()) {
+            const ValueType& one_last = one.end[-1];
+            const ValueType& two_last = two.end[-1];
+            if (!comp_(two_last, one_last)) {
+                ValueType* two_stop = std::lower_bound(two.pos, two.end, one_last, comp_);
+                out = MergeRuns(one.pos, one.end, two.pos, two_stop, out);
+                one.pos = one.end;
+                two.pos = two_stop;
+            } else {
+                ValueType* one_stop = std::upper_bound(one.pos, one.end, two_last, comp_);
+                out = MergeRuns(one.pos, one_stop, two.pos, two.end, out);
+                one.pos = one_stop;
+                two.pos = two.end;
+            }
+            one.Advance();
+            two.Advance();
+        }
+        out = MoveCursor(one, out);
+        return MoveCursor(two, out);
+    }
 
+    template <class OutIt>
+    OutIt MoveCursor(Cursor& cursor, OutIt out) {
+        while (!cursor.done()) {
+            out = MoveRange(cursor.pos, cursor.end, out);
+            cursor.pos = cursor.end;
+            cursor.Advance();
+        }
+        return out;
     }
 
-    // Merge 2 sorted runs into a ping-pong array
-    void BlindMerge(std::array<ValueVector *, 2> &arrs, ValueVector &write,
-                    typename std::list<RunInfo>::iterator cur_run, size_t arr_index) {
-        auto next_run = std::next(cur_run, 1);
-        size_t one = cur_run->elem_index,
-                two = next_run->elem_index,
-                k = cur_run->elem_index;
-        ValueVector &curr_arr = *arrs[cur_run->array_index];
-        ValueVector &next_arr = *arrs[next_run->array_index];
+    // Huffman order unless a scheduler is set, stable sorting only merges neighbouring runs
+    MergeScheduler Scheduler() const {
+        if (scheduler_ == kScheduleAuto || (stable_ && scheduler_ == kScheduleHuffman)) {
+            return stable_ ? kSchedulePowersort : kScheduleHuffman;
+        }
+        return scheduler_;
+    }
 
-        while ((one - cur_run->elem_index) < cur_run->run_size &&
-               (two - next_run->elem_index) < next_run->run_size) {
+    // Merge all runs with loser trees. If there are more runs than kTournamentFanIn, groups of runs are
+    // merged to the other buffer first, so every element is moved once per level instead of once per pairwise pass.
+    // The runs start in the buffer from which the number of levels leads into the output.
+    void TournamentMerge(RAI begin, std::vector<Run*>& runs) {
+        typedef LoserTree<ValueType, Compare> Tree;
+        typedef typename Tree::Range Range;
 
-            if (curr_arr[one] < next_arr[two]) {
-                write[k] = curr_arr[one];
-                one++;
-            } else {
-                write[k] = next_arr[two];
-                two++;
-            }
-            k++;
+        size_t levels = 0;
+        for (size_t groups = runs.size(); groups > kTournamentFanIn; groups = (groups + kTournamentFanIn - 1) / kTournamentFanIn) {
+            levels++;
         }
-        // if both runs don't have the same size, copy the remaining elements over
-        if ((one - cur_run->elem_index) < cur_run->run_size) {
-            for (size_t i = (one - cur_run->elem_index); i < cur_run->run_size; i++) {
-                write[k] = curr_arr[i + cur_run->elem_index];
-                k++;
-            }
-        } else {
-            for (size_t i = (two - next_run->elem_index); i < next_run->run_size; i++) {
-                write[k] = next_arr[i + next_run->elem_index];
-                k++;
+        Buffer first;
+        ValueType* buffers[2] = { levels > 0 ? OutputBuffer(begin, first) : NULL, Scratch(num_elements_) };
+        size_t cur = (levels + 1) % 2;
+
+        std::vector<Range> ranges;
+        ranges.reserve(runs.size());
+        ValueType* next_empty = buffers[cur];
+        for (size_t i = 0; i < runs.size(); i++) {
+            ValueType* run_end = MoveRun(runs[i], next_empty);
+            FreeBlocks(runs[i]);
+            ranges.push_back(Range(next_empty, run_end));
+            next_empty = run_end;
+        }
+
+        while (ranges.size() > kTournamentFanIn) {
+            std::vector<Range> merged;
+            ValueType* out = buffers[1 - cur];
+            for (size_t i = 0; i < ranges.size(); i += kTournamentFanIn) {
+                std::vector<Range> group(ranges.begin() + i, ranges.begin() + std::min(i + kTournamentFanIn, ranges.size()));
+                Tree tree(group, comp_);
+                ValueType* group_end = tree.Merge(out);
+                merged.push_back(Range(out, group_end));
+                out = group_end;
             }
+            ranges.swap(merged);
+            cur = 1 - cur;
         }
-        cur_run->array_index = arr_index;
+
+        Tree tree(ranges, comp_);
+        tree.Merge(OutputIterator<RAI>::Get(begin));
+        stats_.AddMergePasses(levels + 1);
+        stats_.AddMoved((levels + 2) * num_elements_ * sizeof(ValueType));
     }
 
-    // Merge the last 2 runs directly to the output
-    void BlindMerge(std::array<ValueVector *, 2> &arrs, RAI begin,
-                    typename std::list<RunInfo>::iterator cur_run) {
-        auto next_run = std::next(cur_run, 1);
-        size_t one = cur_run->elem_index,
-                two = next_run->elem_index;
-        ValueVector &curr_arr = *arrs[cur_run->array_index];
-        ValueVector &next_arr = *arrs[next_run->array_index];
+    // Estimated number of passes over the data the pairwise merge needs, that is the cost of an optimal
+    // (Huffman) merge order of the run sizes divided by the number of elements
+    float PairwiseMergePasses(const std::vector<Run*>& runs) {
+        std::vector<size_t> sizes(runs.size());
+        for (size_t i = 0; i < runs.size(); i++) {
+            sizes[i] = runs[i]->size();
+        }
+        std::vector<MergeStep> steps;
+        ScheduleHuffman(sizes, steps);
+        return MergeCost(sizes, steps) / static_cast<float>(num_elements_);
+    }
 
-        while ((one - cur_run->elem_index) < cur_run->run_size &&
-               (two - next_run->elem_index) < next_run->run_size) {
+    // Merge in rounds: every round merges neighbouring pairs of runs into the other ping-pong array and the
+    // last round merges the remaining 2 runs into the output. Each round is split into equally sized slices
+    // of the output by co-ranking, so the threads write disjoint parts even if only one pair is left.
+    // The output range is one of the ping-pong arrays, the runs start in the array that lets the last round end in it.
+    void ParallelMerge(RAI begin, std::vector<Run*>& runs, size_t num_threads) {
+        SortRunsBySize(runs);
+        size_t rounds = 0;
+        for (size_t count = runs.size(); count > 1; count = (count + 1) / 2) {
+            rounds++;
+        }
+        Buffer first;
+        ValueType* buffers[2] = { rounds > 1 ? OutputBuffer(begin, first) : NULL, Scratch(num_elements_) };
+        std::vector<RunInfo> run_infos;
+        run_infos.reserve(runs.size());
 
-            if (curr_arr[one] < next_arr[two]) {
-                *begin = curr_arr[one];
-                one++;
-            } else {
-                *begin = next_arr[two];
-                two++;
+        size_t next_empty_arr_loc = 0;
+        for (size_t i = 0; i < runs.size(); i++) {
+            run_infos.push_back(RunInfo(next_empty_arr_loc, runs[i]->size()));
+            next_empty_arr_loc += runs[i]->size();
+        }
+
+        // move the runs to the first ping-pong array, every thread takes every num_threads-th run
+        ValueType* src = buffers[rounds % 2];
+        ValueType* dst = buffers[(rounds + 1) % 2];
+        RunParallel(num_threads, [&](size_t t) {
+            for (size_t i = t; i < runs.size(); i += num_threads) {
+                MoveRun(runs[i], src + run_infos[i].elem_index);
             }
-            begin++;
+        });
+        for (Run* run : runs) {
+            FreeBlocks(run);
         }
-        if ((one - cur_run->elem_index) < cur_run->run_size) {
-            for (size_t i = (one - cur_run->elem_index); i < cur_run->run_size; i++) {
-                *begin = curr_arr[i + cur_run->elem_index];
-                begin++;
+
+        while (run_infos.size() > 2) {
+            MergePairs(src, dst, run_infos, num_threads);
+
+            std::vector<RunInfo> merged;
+            merged.reserve((run_infos.size() + 1) / 2);
+            for (size_t i = 0; i < run_infos.size(); i += 2) {
+                RunInfo run_info = run_infos[i];
+                if (i + 1 < run_infos.size()) {
+                    run_info.run_size += run_infos[i + 1].run_size;
+                }
+                merged.push_back(run_info);
             }
-        } else {
-            for (size_t i = (two - next_run->elem_index); i < next_run->run_size; i++) {
-                *begin = next_arr[i + next_run->elem_index];
-                begin++;
+            run_infos.swap(merged);
+            std::swap(src, dst);
+        }
+
+        MergePairs(src, OutputIterator<RAI>::Get(begin), run_infos, num_threads);
+        stats_.AddMergePasses(rounds);
+        stats_.AddMoved((rounds + 1) * num_elements_ * sizeof(ValueType));
+    }
+
+    // Merge the runs 0 and 1, 2 and 3, ... from src to out, a run without partner is moved
+    template <class OutIt>
+    void MergePairs(ValueType* src, OutIt out, const std::vector<RunInfo>& run_infos, size_t num_threads) {
+        // Co-rank all slice boundaries before the threads start, co-ranking looks at elements of the neighbouring
+        // slices which are moved away by their thread. split[t] is the number of elements of the first run of a
+        // pair that belong to the merged output in front of the boundary of slice t inside the pair.
+        std::vector<size_t> split(num_threads + 1, 0);
+        size_t pair = 0;
+        for (size_t t = 1; t < num_threads; t++) {
+            const size_t k = num_elements_ * t / num_threads;
+            while (pair + 2 < run_infos.size() && run_infos[pair + 2].elem_index <= k) {
+                pair += 2;
+            }
+            const RunInfo& first = run_infos[pair];
+            const size_t second_size = pair + 1 < run_infos.size() ? run_infos[pair + 1].run_size : 0;
+            ValueType* one = src + first.elem_index;
+            split[t] = CoRank(k - first.elem_index, one, first.run_size, one + first.run_size, second_size, comp_);
+        }
+
+        RunParallel(num_threads, [&](size_t t) {
+            const size_t k_begin = num_elements_ * t / num_threads;
+            const size_t k_end = num_elements_ * (t + 1) / num_threads;
+
+            for (size_t i = 0; i < run_infos.size(); i += 2) {
+                const RunInfo& first = run_infos[i];
+                const size_t second_size = i + 1 < run_infos.size() ? run_infos[i + 1].run_size : 0;
+                const size_t pair_begin = first.elem_index;
+                const size_t pair_end = pair_begin + first.run_size + second_size;
+                if (pair_end <= k_begin) {
+                    continue;
+                }
+                if (pair_begin >= k_end) {
+                    break;
+                }
+
+                const size_t lo = std::max(k_begin, pair_begin) - pair_begin;
+                const size_t hi = std::min(k_end, pair_end) - pair_begin;
+                const size_t one_lo = k_begin > pair_begin ? split[t] : 0;
+                const size_t one_hi = k_end < pair_end ? split[t + 1] : first.run_size;
+                ValueType* one = src + first.elem_index;
+                ValueType* two = one + first.run_size;
+                MergeRuns(one + one_lo, one + one_hi, two + (lo - one_lo), two + (hi - one_hi), out + (pair_begin + lo));
             }
+        });
+    }
+
+    // Merge 2 sorted runs, arithmetic keys ordered by operator< and written through a pointer use the SIMD merge kernels.
+    // The elements of one that are not greater than the head of two are in front of the merged part and the elements
+    // of two that are not less than the last one of one are behind it. Both are found by galloping and moved in bulk,
+    // so runs that do not overlap, which is common for nearly sorted input, are only moved.
+    template <class OutIt>
+    OutIt MergeRuns(ValueType* one, ValueType* one_end, ValueType* two, ValueType* two_end, OutIt out) {
+        typedef std::integral_constant<bool, IsSimdMergeType<ValueType>::value
+                                             && std::is_same<Compare, std::less<ValueType>>::value
+                                             && std::is_same<OutIt, ValueType*>::value> UseSimd;
+        if (one != one_end && two != two_end) {
+            ValueType* one_stop = GallopUpper(one, one_end, *two, comp_);
+            out = MoveRange(one, one_stop, out);
+            one = one_stop;
+        }
+        if (one == one_end || two == two_end) {
+            out = MoveRange(one, one_end, out);
+            return MoveRange(two, two_end, out);
         }
+        ValueType* two_stop = GallopLowerFromBack(two, two_end, one_end[-1], comp_);
+        out = MergeRuns(one, one_end, two, two_stop, out, UseSimd());
+        return MoveRange(two_stop, two_end, out);
     }
 
-    static void SetMemSize(size_t s) {
-        run_blocks_ = s;
+    template <class OutIt>
+    OutIt MergeRuns(ValueType* one, ValueType* one_end, ValueType* two, ValueType* two_end, OutIt out,
+                    std::true_type) {
+        return SimdMerge<ValueType>(one, one_end, two, two_end, out);
     }
 
-    static void Init() {
-        memory_ = new RunPool<ValueType>[run_blocks_];
-        next_free_ = memory_;
+    template <class OutIt>
+    OutIt MergeRuns(ValueType* one, ValueType* one_end, ValueType* two, ValueType* two_end, OutIt out,
+                    std::false_type) {
+        return MergeRanges(one, one_end, two, two_end, out, comp_);
     }
 
-    static void Release() {
-        delete[] memory_;
-        memory_ = NULL;
+    // merge buffer of at least n elements that is kept for the next call
+    ValueType* Scratch(size_t n) {
+        return scratch_.Resize(n, memory_policy_);
     }
 
-    // Fetch a new memory block from the pool
-    static RunPool<ValueType>* Alloc() {
-        RunPool<ValueType>* ret = next_free_;
-        next_free_++;
-        return ret;
+    // The output range as merge buffer, a copy of it if the elements are not contiguous
+    ValueType* OutputBuffer(RAI begin, Buffer& fallback) {
+        return OutputBuffer(begin, fallback, std::integral_constant<bool, IsContiguousIterator<RAI>::value>());
     }
 
-    // Counts how many elements in the input sequence are not in ascending order
-    int GetOrderLevel(RAI first, RAI last) {
-        int k = 0;
-        last -= 1;
-        for(RAI i = first; i != last; ++i) {
-            k += (*i > *(i+1));
+    ValueType* OutputBuffer(RAI begin, Buffer&, std::true_type) {
+        return &*begin;
+    }
+
+    ValueType* OutputBuffer(RAI, Buffer& fallback, std::false_type) {
+        return fallback.Resize(num_elements_, memory_policy_);
+    }
+
+    // The merge phases start with the smallest runs. Stable sorting keeps the runs in the order they were
+    // created, so equal elements of neighbouring runs are merged in input order.
+    void SortRunsBySize(std::vector<Run*>& runs) {
+        if(stable_) {
+            return;
         }
-        return k;
+        std::sort(runs.begin(), runs.end(), [](const Run* a, const Run* b) { return
+                a->size() <
+                b->size(); });
+    }
+
+    // runblocks fetched from the arenas of this sorter and its run generation threads so far
+    size_t AllocatedBlocks() const {
+        size_t allocated = arena_->Allocated();
+        for (auto& worker : workers_) {
+            allocated += worker->AllocatedBlocks();
+        }
+        return allocated;
+    }
+
+    void ReleaseRuns() {
+        num_pools_ = 0;
+        arena_->Recycle();
+    }
+
+    // Move the elements of a run to out block by block, returns the position behind the last moved element.
+    // Every block is one contiguous piece, so trivially copyable elements are moved with one memmove per block.
+    template <class OutIt>
+    OutIt MoveRun(Run* run, OutIt out) {
+        for (RunBlock<ValueType, kBlockSize>* block = run->first_block(); block != NULL; block = block->next) {
+            out = MoveRange(Run::block_begin(block), Run::block_end(block), out);
+        }
+        return out;
+    }
+
+    // Hand the blocks of a run back to its arena after MoveRun(), like the cursors of the ping-pong merge do
+    void FreeBlocks(Run* run) {
+        for (RunBlock<ValueType, kBlockSize>* block = run->first_block(); block != NULL; ) {
+            RunBlock<ValueType, kBlockSize>* next = block->next;
+            run->arena()->Free(block);
+            block = next;
+        }
+    }
+
+    // Create a new empty run that fetches its blocks from the arena of this sorter
+    Run* NewRun() {
+        if (num_pools_ < run_pools_.size()) {
+            run_pools_[num_pools_] = Run(arena_);
+        } else {
+            run_pools_.emplace_back(arena_);
+        }
+        return &run_pools_[num_pools_++];
     }
 
     size_t GetMemPoolSize(const size_t num_elements, const size_t num_runs) {
@@ -327,21 +1289,300 @@ private:
     }
 };
 
-template <class RAI>
-RunPool<typename RAI::value_type>* PatienceSorting<RAI>::memory_ = NULL;
 
-template <class RAI>
-RunPool<typename RAI::value_type>* PatienceSorting<RAI>::next_free_ = NULL;
+// simple function that applies patience sorting in the same style as std::sort
+template <class RandomAccessIterator>
+void PatienceSortFunc(RandomAccessIterator begin, RandomAccessIterator end) {
+    PatienceSorting<RandomAccessIterator>  ps;
+    ps.Sort(begin, end);
+}
 
-template <class RAI>
-size_t PatienceSorting<RAI>::run_blocks_;
+// the smallest middle - begin elements of [begin, end) in ascending order in [begin, middle) like std::partial_sort
+template <class RandomAccessIterator>
+void PatiencePartialSort(RandomAccessIterator begin, RandomAccessIterator middle, RandomAccessIterator end) {
+    PatienceSorting<RandomAccessIterator>  ps;
+    ps.PartialSort(begin, middle, end);
+}
 
+template <class RandomAccessIterator, class Compare>
+void PatiencePartialSort(RandomAccessIterator begin, RandomAccessIterator middle, RandomAccessIterator end, Compare comp) {
+    PatienceSorting<RandomAccessIterator, Compare>  ps(comp);
+    ps.PartialSort(begin, middle, end);
+}
 
-// simple function that applies patience sorting in the same style as std::sort
+// the element that belongs to nth in sorted order at nth like std::nth_element, the elements before it are sorted
 template <class RandomAccessIterator>
-void PatienceSortFunc(RandomAccessIterator begin, RandomAccessIterator end) {
+void PatienceNthElement(RandomAccessIterator begin, RandomAccessIterator nth, RandomAccessIterator end) {
+    PatienceSorting<RandomAccessIterator>  ps;
+    ps.NthElement(begin, nth, end);
+}
+
+template <class RandomAccessIterator, class Compare>
+void PatienceNthElement(RandomAccessIterator begin, RandomAccessIterator nth, RandomAccessIterator end, Compare comp) {
+    PatienceSorting<RandomAccessIterator, Compare>  ps(comp);
+    ps.NthElement(begin, nth, end);
+}
+
+// patience sorting with a custom comparator, equal elements may change their order like with std::sort
+template <class RandomAccessIterator, class Compare>
+void PatienceSortFunc(RandomAccessIterator begin, RandomAccessIterator end, Compare comp) {
+    PatienceSorting<RandomAccessIterator, Compare>  ps(comp);
+    ps.Sort(begin, end);
+}
+
+// patience sorting that keeps equal elements in their input order like std::stable_sort
+template <class RandomAccessIterator, class Compare>
+void StablePatienceSortFunc(RandomAccessIterator begin, RandomAccessIterator end, Compare comp) {
+    PatienceSorting<RandomAccessIterator, Compare>  ps(comp);
+    ps.SetStable(true);
+    ps.Sort(begin, end);
+}
+
+// patience sorting with parallel run generation and merge phase, 0 threads uses all cores
+template <class RandomAccessIterator>
+void ParallelPatienceSortFunc(RandomAccessIterator begin, RandomAccessIterator end, size_t num_threads) {
     PatienceSorting<RandomAccessIterator>  ps;
+    ps.SetNumThreads(num_threads);
+    ps.SetRunGenerationThreads(num_threads);
     ps.Sort(begin, end);
 }
 
+
+// Orders records by the key key(record) returns
+template <class KeyFunc>
+struct KeyLess {
+    KeyFunc key;
+    template <typename T>
+    bool operator()(const T& a, const T& b) const { return key(a) < key(b); }
+};
+
+// stable sort of records by one of their fields, e.g. PatienceSortByKey(b, e, [](const Rec& r) { return r.time; })
+template <class RandomAccessIterator, class KeyFunc>
+void PatienceSortByKey(RandomAccessIterator begin, RandomAccessIterator end, KeyFunc key) {
+    StablePatienceSortFunc(begin, end, KeyLess<KeyFunc>{key});
+}
+
+
+// Key and input position of one element of the key-value sort. Equal keys are ordered by their position,
+// so the order is total and the sort is stable without restricting the run generation.
+template <typename Key, typename Index>
+struct KeyIndex {
+    Key key;
+    Index index;
+};
+
+template <typename Key, typename Index, class Compare>
+struct KeyIndexLess {
+    Compare comp;
+    bool operator()(const KeyIndex<Key, Index>& a, const KeyIndex<Key, Index>& b) const {
+        if(comp(a.key, b.key)) {
+            return true;
+        }
+        return !comp(b.key, a.key) && a.index < b.index;
+    }
+};
+
+// integer keys of up to 32 bits are packed with their position into one 64 bit integer, which sorts with
+// the SIMD kernels
+template <typename Key, class Compare>
+struct IsPackedKey {
+    static const bool value = std::is_integral<Key>::value && sizeof(Key) <= 4
+                              && std::is_same<Compare, std::less<Key>>::value;
+};
+
+template <typename Key>
+uint64_t PackKey(Key key, uint64_t index) {
+    const int64_t offset = static_cast<int64_t>(key) - static_cast<int64_t>(std::numeric_limits<Key>::min());
+    return (static_cast<uint64_t>(offset) << 32) | index;
+}
+
+template <typename Key>
+Key UnpackKey(uint64_t packed) {
+    return static_cast<Key>(static_cast<int64_t>(packed >> 32) + static_cast<int64_t>(std::numeric_limits<Key>::min()));
+}
+
+// Move payload[order[j]] to payload[j] for every j. The elements are gathered into a buffer and moved back,
+// the gather reads are independent of each other, unlike following the cycles of the permutation.
+template <class PayloadIt, typename Index>
+void PermutePayload(PayloadIt payload, const std::vector<Index>& order) {
+    typedef typename std::iterator_traits<PayloadIt>::value_type Payload;
+    std::vector<Payload> gathered;
+    gathered.reserve(order.size());
+    for (size_t j = 0; j < order.size(); j++) {
+        gathered.push_back(std::move(payload[order[j]]));
+    }
+    std::move(gathered.begin(), gathered.end(), payload);
+}
+
+template <class KeyIt, class PayloadIt, class Compare>
+void PatienceSortKeyValue(KeyIt key_begin, KeyIt key_end, PayloadIt payload_begin, Compare, size_t num_threads,
+                          std::true_type) {
+    typedef typename std::iterator_traits<KeyIt>::value_type Key;
+    const size_t num_elements = std::distance(key_begin, key_end);
+    std::vector<uint64_t> packed(num_elements);
+    for (size_t i = 0; i < num_elements; i++) {
+        packed[i] = PackKey(key_begin[i], i);
+    }
+
+    ParallelPatienceSortFunc(packed.begin(), packed.end(), num_threads);
+
+    std::vector<uint32_t> order(num_elements);
+    for (size_t i = 0; i < num_elements; i++) {
+        key_begin[i] = UnpackKey<Key>(packed[i]);
+        order[i] = static_cast<uint32_t>(packed[i]);
+    }
+    PermutePayload(payload_begin, order);
+}
+
+template <class KeyIt, class PayloadIt, class Compare>
+void PatienceSortKeyValue(KeyIt key_begin, KeyIt key_end, PayloadIt payload_begin, Compare comp, size_t num_threads,
+                          std::false_type) {
+    typedef typename std::iterator_traits<KeyIt>::value_type Key;
+    typedef KeyIndex<Key, size_t> Element;
+    typedef typename std::vector<Element>::iterator ElementIt;
+    const size_t num_elements = std::distance(key_begin, key_end);
+    std::vector<Element> elements(num_elements);
+    for (size_t i = 0; i < num_elements; i++) {
+        elements[i].key = std::move(key_begin[i]);
+        elements[i].index = i;
+    }
+
+    PatienceSorting<ElementIt, KeyIndexLess<Key, size_t, Compare>> ps(KeyIndexLess<Key, size_t, Compare>{comp});
+    ps.SetNumThreads(num_threads);
+    ps.SetRunGenerationThreads(num_threads);
+    ps.Sort(elements.begin(), elements.end());
+
+    std::vector<size_t> order(num_elements);
+    for (size_t i = 0; i < num_elements; i++) {
+        key_begin[i] = std::move(elements[i].key);
+        order[i] = elements[i].index;
+    }
+    PermutePayload(payload_begin, order);
+}
+
+// Stable sort of the keys [key_begin, key_end) where the payload at the same position moves with its key,
+// e.g. timestamps and the records they belong to. The payload is moved, not compared, 0 threads uses all cores.
+template <class KeyIt, class PayloadIt, class Compare>
+void PatienceSortKeyValue(KeyIt key_begin, KeyIt key_end, PayloadIt payload_begin, Compare comp, size_t num_threads = 1) {
+    typedef typename std::iterator_traits<KeyIt>::value_type Key;
+    const bool packed = IsPackedKey<Key, Compare>::value
+                        && static_cast<uint64_t>(std::distance(key_begin, key_end)) <= std::numeric_limits<uint32_t>::max();
+    if (packed) {
+        PatienceSortKeyValue(key_begin, key_end, payload_begin, comp, num_threads,
+                             std::integral_constant<bool, IsPackedKey<Key, Compare>::value>());
+    } else {
+        PatienceSortKeyValue(key_begin, key_end, payload_begin, comp, num_threads, std::false_type());
+    }
+}
+
+template <class KeyIt, class PayloadIt>
+void PatienceSortKeyValue(KeyIt key_begin, KeyIt key_end, PayloadIt payload_begin) {
+    PatienceSortKeyValue(key_begin, key_end, payload_begin, std::less<typename std::iterator_traits<KeyIt>::value_type>());
+}
+
+
+// best time of a few sorts of a copy of input with a forced strategy in milliseconds
+template <class Vector>
+float TimeStrategy(const Vector& input, SortStrategy strategy, int rounds = 3) {
+    PatienceSorting<typename Vector::iterator> sorter;
+    sorter.SetStrategy(strategy);
+    float best = 0;
+    for(int i = 0; i < rounds; i++) {
+        Vector values = input;
+        auto t0 = std::chrono::steady_clock::now();
+        sorter.Sort(values.begin(), values.end());
+        auto t1 = std::chrono::steady_clock::now();
+        float ms = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / 1000.0f;
+        best = (i == 0 || ms < best) ? ms : best;
+    }
+    return best;
+}
+
+// Measure the thresholds of the strategy selection on the machine it runs on, the result is passed to
+// PatienceSorting::SetThresholds(). It takes a few seconds, so the sorters do not call it themselves and keep the
+// defaults unless they get its result. Sorted integers with a growing share of random values are sorted with every
+// strategy. The natural merge is chosen up to the disorder it stays the fastest strategy for, the fallback from the
+// disorder on from which it beats patience sort on all more random inputs. Then blocks of random values, sorted
+// ascending and descending in turn, get shorter until the natural merge of these runs loses against the fallback,
+// which their descents would pick otherwise. A strategy only wins if it is faster by
+// kCalibrationMargin, a threshold between two inputs is the middle of their probes.
+inline StrategyThresholds CalibrateStrategy(size_t num_elements = 1 << 20) {
+    typedef std::vector<int> Vector;
+    const float kCalibrationMargin = 1.05f;
+    std::mt19937 mt(num_elements);
+    std::uniform_int_distribution<int> dist_value(0, static_cast<int>(num_elements));
+    std::uniform_int_distribution<size_t> dist_pos(0, num_elements - 1);
+
+    StrategyThresholds thresholds;
+    thresholds.max_natural_descents = 0.0f;
+    thresholds.max_descents = 1.0f;
+    thresholds.max_inversions = 1.0f;
+
+    // warm up the allocator and the caches, the first sort is slower than the others
+    TimeStrategy(Vector(num_elements, 0), kStrategyRadix, 1);
+
+    DisorderProbe last;
+    bool natural_wins = true;
+    bool fallback_wins = false;
+    for(float share = 0.01f; ; share = std::min(1.0f, share * 1.5f)) {
+        Vector values(num_elements);
+        for(size_t i = 0; i < num_elements; i++) {
+            values[i] = static_cast<int>(i);
+        }
+        for(size_t i = 0; i < num_elements * share; i++) {
+            values[dist_pos(mt)] = dist_value(mt);
+        }
+        const DisorderProbe probe = ProbeDisorder(values.begin(), values.end(), std::less<int>());
+        const float patience = TimeStrategy(values, kStrategyPatience);
+        const float fallback = TimeStrategy(values, kStrategyRadix);          // the fallback of integer keys
+        const float natural = TimeStrategy(values, kStrategyNaturalMerge);
+
+        natural_wins = natural_wins && natural * kCalibrationMargin < std::min(patience, fallback);
+        if(natural_wins) {
+            thresholds.max_natural_descents = probe.descents;
+        }
+        if(fallback * kCalibrationMargin >= patience) {
+            thresholds.max_descents = 1.0f;
+            thresholds.max_inversions = 1.0f;
+        } else if(!fallback_wins) {
+            thresholds.max_descents = (last.descents + probe.descents) / 2;
+            thresholds.max_inversions = (last.inversions + probe.inversions) / 2;
+        }
+        fallback_wins = fallback * kCalibrationMargin < patience;
+        last = probe;
+        if(share == 1.0f) {
+            break;
+        }
+    }
+
+    // values from the whole range, equal neighbours would split the descending runs
+    std::uniform_int_distribution<int> dist_run_value;
+    thresholds.max_natural_runs = 0.0f;
+    last = DisorderProbe();
+    for(size_t block = num_elements / 4; block >= kMinNaturalRun; block /= 2) {
+        Vector values(num_elements);
+        for(size_t i = 0; i < num_elements; i++) {
+            values[i] = dist_run_value(mt);
+        }
+        for(size_t i = 0; i < num_elements; i += block) {
+            const Vector::iterator first = values.begin() + i;
+            const Vector::iterator last = values.begin() + std::min(num_elements, i + block);
+            std::sort(first, last);
+            if((i / block) % 2 == 1) {
+                std::reverse(first, last);
+            }
+        }
+        const DisorderProbe probe = ProbeDisorder(values.begin(), values.end(), std::less<int>());
+        const float fallback = TimeStrategy(values, kStrategyRadix);
+        const float natural = TimeStrategy(values, kStrategyNaturalMerge);
+        if(natural * kCalibrationMargin >= fallback) {
+            thresholds.max_natural_runs = (last.runs + probe.runs) / 2;
+            break;
+        }
+        thresholds.max_natural_runs = probe.runs;
+        last = probe;
+    }
+    return thresholds;
+}
+
 #endif
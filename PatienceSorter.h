@@ -0,0 +1,193 @@
+#ifndef PATIENCESORTER_H
+#define PATIENCESORTER_H
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <functional>
+#include <utility>
+
+#include "PatienceSort.h"
+
+
+// Incremental patience sort for data that arrives in batches. Every pushed element is added to the runs right away,
+// the runs, lasts_ and heads_ stay alive between the calls, so only the merge phase is left when the data is drained.
+// A watermark drain emits the elements below a value the producer will not go under again, e.g. the event time
+// up to which all events have arrived, and keeps the rest for the next drain.
+template <typename ValueType, class Compare = std::less<ValueType>>
+class PatienceSorter {
+public:
+    typedef std::vector<ValueType>                              ValueVector;
+    typedef PatienceSorting<typename ValueVector::iterator, Compare>  Sorting;
+    typedef typename Sorting::Run                               Run;
+    typedef typename Sorting::Cursor::Block                     Block;
+
+
+    explicit PatienceSorter(Compare comp = Compare()) : sorting_(comp), comp_(comp) { }
+
+    // use a caller supplied arena for the runblocks
+    explicit PatienceSorter(BlockArena<ValueType>& arena, Compare comp = Compare()) : sorting_(arena, comp), comp_(comp) { }
+
+    PatienceSorter(const PatienceSorter&) =               delete;
+    PatienceSorter& operator=(const PatienceSorter&) =    delete;
+
+
+    // add one element, it is moved into its run
+    void Push(ValueType value) {
+        CountLate(&value, &value + 1);
+        sorting_.template AddToRuns<true>(&value, &value + 1, runs_);
+        size_++;
+    }
+
+    // add the elements of [first, last), they are copied into the runs
+    template <class It>
+    void Push(It first, It last) {
+        CountLate(first, last);
+        sorting_.template AddToRuns<false>(first, last, runs_);
+        size_ += std::distance(first, last);
+    }
+
+    // Merge all elements pushed so far into out in ascending order and start over empty
+    template <class OutIt>
+    OutIt DrainSorted(OutIt out) {
+        ValueVector sorted;
+        MergeAll(sorted);
+        return std::move(sorted.begin(), sorted.end(), out);
+    }
+
+    // all elements pushed so far in ascending order, the sorter is empty afterwards
+    ValueVector Finish() {
+        ValueVector sorted;
+        MergeAll(sorted);
+        return sorted;
+    }
+
+    // Emit the prefix that is final: all elements that are less than watermark, in ascending order. Later pushes
+    // must not be less than the watermark, those that are anyway are counted by LateElements() and come out
+    // with a later drain. Only the elements below the watermark are split off their runs and merged, the rest of
+    // every run stays in its blocks.
+    template <class OutIt>
+    OutIt DrainBelow(const ValueType& watermark, OutIt out) {
+        typedef typename Sorting::Bound Bound;
+
+        watermark_ = watermark;
+        has_watermark_ = true;
+        std::vector<Run*> below;
+        size_t count = 0;
+        size_t num_runs = 0;
+        for (Run* run : runs_) {
+            const size_t run_below = CountBelow(*run);
+            if (run_below == run->size()) {
+                below.push_back(run);
+            } else {
+                num_runs++;
+                if (run_below > 0) {
+                    below.push_back(sorting_.NewRun());
+                    run->SplitFront(run_below, *below.back());
+                }
+            }
+            count += run_below;
+        }
+        if (count == 0) {
+            return out;
+        }
+        ValueVector sorted(count);
+        sorting_.num_elements_ = count;
+        sorting_.Merge(sorted.begin(), below);
+        out = std::move(sorted.begin(), sorted.end(), out);
+        size_ -= count;
+
+        // The runs whose last element is below the watermark are merged completely. lasts_ is descending, so they
+        // are the last runs, and the runs that are left are still the first ones of the pool of the sorter. The
+        // heads are lowered to the smallest head behind them, so they stay ascending and a prepend still fits.
+        const typename Bound::Less less = Bound::MakeLess(comp_);
+        runs_.resize(num_runs);
+        sorting_.lasts_.resize(num_runs);
+        sorting_.heads_.resize(num_runs);
+        sorting_.num_pools_ = num_runs;
+        for (size_t i = num_runs; i-- > 0; ) {
+            const typename Bound::Type head = Bound::Make(runs_[i]->front());
+            sorting_.lasts_[i] = Bound::Make(runs_[i]->back());
+            sorting_.heads_[i] = i + 1 < num_runs && less(sorting_.heads_[i + 1], head) ? sorting_.heads_[i + 1] : head;
+        }
+        return out;
+    }
+
+    // number of elements that were pushed and not drained yet
+    size_t Size() const {
+        return size_;
+    }
+
+    size_t NumRuns() const {
+        return runs_.size();
+    }
+
+    // elements that were pushed below the watermark of an earlier drain
+    size_t LateElements() const {
+        return late_;
+    }
+
+    // threads of the merge phase of a drain, 0 uses all cores
+    void SetNumThreads(size_t num_threads) {
+        sorting_.SetNumThreads(num_threads);
+    }
+
+    void SetMergeMode(MergeMode mode) {
+        sorting_.SetMergeMode(mode);
+    }
+
+    // hugepages, NUMA placement and prefault threads of the runblocks and the merge buffers
+    void SetMemoryPolicy(const MemoryPolicy& policy) {
+        sorting_.SetMemoryPolicy(policy);
+    }
+
+
+private:
+    Sorting sorting_;
+    Compare comp_;
+    std::vector<Run*> runs_;
+    size_t size_ = 0;
+    size_t late_ = 0;
+    ValueType watermark_ = ValueType();
+    bool has_watermark_ = false;
+
+    template <class It>
+    void CountLate(It first, It last) {
+        if (!has_watermark_) {
+            return;
+        }
+        for (; first != last; ++first) {
+            late_ += comp_(*first, watermark_);
+        }
+    }
+
+    // number of elements of run that are less than the watermark, whole blocks are skipped by their last element
+    size_t CountBelow(Run& run) const {
+        size_t count = 0;
+        for (Block* block = run.first_block(); block != NULL; block = block->next) {
+            ValueType* first = Run::block_begin(block);
+            ValueType* last = Run::block_end(block);
+            if (first != last && !comp_(last[-1], watermark_)) {
+                return count + (std::lower_bound(first, last, watermark_, comp_) - first);
+            }
+            count += last - first;
+        }
+        return count;
+    }
+
+    // merge the runs into sorted and release them
+    void MergeAll(ValueVector& sorted) {
+        sorted.resize(size_);
+        if (size_ > 0) {
+            sorting_.num_elements_ = size_;
+            sorting_.Merge(sorted.begin(), runs_);
+        }
+        runs_.clear();
+        sorting_.lasts_.clear();
+        sorting_.heads_.clear();
+        sorting_.ReleaseRuns();
+        size_ = 0;
+    }
+};
+
+#endif
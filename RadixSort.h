@@ -0,0 +1,100 @@
+#ifndef RADIXSORT_H
+#define RADIXSORT_H
+
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+
+
+// LSD radix sort for integer and floating point keys, the fallback for random input of these types.
+// Every key is mapped to an unsigned integer with the same order, which is sorted by 8 bit digits from the lowest
+// to the highest. With 256 buckets the write positions of one pass stay in L1, so the scatter streams through
+// the cache. The histograms of all digits are counted in a single pass, and digits that are equal for all keys
+// are skipped, e.g. the upper bytes of small integers.
+
+const size_t kRadixBits =       8;
+const size_t kRadixBuckets =    1 << kRadixBits;
+
+
+template <size_t kSize> struct RadixUnsigned;
+template <> struct RadixUnsigned<1> { typedef uint8_t Type; };
+template <> struct RadixUnsigned<2> { typedef uint16_t Type; };
+template <> struct RadixUnsigned<4> { typedef uint32_t Type; };
+template <> struct RadixUnsigned<8> { typedef uint64_t Type; };
+
+// Order preserving mapping of a key to an unsigned integer: signed integers flip the sign bit, floating point
+// numbers flip all bits if they are negative and only the sign bit otherwise
+template <typename T, bool = std::is_floating_point<T>::value>
+struct RadixKey {
+    typedef typename RadixUnsigned<sizeof(T)>::Type Type;
+    static const Type kSignBit = std::is_signed<T>::value ? Type(1) << (sizeof(T) * 8 - 1) : 0;
+    static Type Get(T value) { return static_cast<Type>(value) ^ kSignBit; }
+};
+
+template <typename T>
+struct RadixKey<T, true> {
+    typedef typename RadixUnsigned<sizeof(T)>::Type Type;
+    static const Type kSignBit = Type(1) << (sizeof(T) * 8 - 1);
+    static Type Get(T value) {
+        Type bits;
+        std::memcpy(&bits, &value, sizeof(T));
+        return bits ^ ((bits & kSignBit) ? Type(~Type(0)) : Type(kSignBit));
+    }
+};
+
+// integer and floating point keys in ascending order can be sorted by their digits
+template <typename T, class Compare>
+struct IsRadixSort {
+    static const bool value = (std::is_integral<T>::value || std::is_floating_point<T>::value)
+                              && !std::is_same<T, bool>::value && sizeof(T) <= 8
+                              && std::is_same<Compare, std::less<T>>::value;
+};
+
+
+// Sort data[0, n) with buffer as the second array of the scatter passes, the result is in data
+template <typename T>
+void RadixSort(T* data, size_t n, T* buffer) {
+    typedef RadixKey<T> Key;
+    typedef typename Key::Type Unsigned;
+    const size_t kDigits = sizeof(Unsigned);
+    if(n < 2) {
+        return;
+    }
+
+    size_t counts[kDigits][kRadixBuckets] = {};
+    for(size_t i = 0; i < n; i++) {
+        Unsigned key = Key::Get(data[i]);
+        for(size_t d = 0; d < kDigits; d++) {
+            counts[d][(key >> (d * kRadixBits)) & (kRadixBuckets - 1)]++;
+        }
+    }
+
+    T* src = data;
+    T* dst = buffer;
+    const Unsigned first_key = Key::Get(data[0]);
+    for(size_t d = 0; d < kDigits; d++) {
+        const size_t shift = d * kRadixBits;
+        if(counts[d][(first_key >> shift) & (kRadixBuckets - 1)] == n) {
+            continue;
+        }
+
+        size_t offsets[kRadixBuckets];
+        size_t sum = 0;
+        for(size_t b = 0; b < kRadixBuckets; b++) {
+            offsets[b] = sum;
+            sum += counts[d][b];
+        }
+        for(size_t i = 0; i < n; i++) {
+            dst[offsets[(Key::Get(src[i]) >> shift) & (kRadixBuckets - 1)]++] = src[i];
+        }
+        std::swap(src, dst);
+    }
+
+    if(src != data) {
+        std::copy(src, src + n, data);
+    }
+}
+
+#endif
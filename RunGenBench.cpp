@@ -0,0 +1,83 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "PatienceSort.h"
+
+using namespace std;
+
+
+// int without arithmetic type, the run generation uses std::lower_bound for it
+struct BoxedInt {
+    int value;
+    bool operator<(const BoxedInt& other) const { return value < other.value; }
+    bool operator>(const BoxedInt& other) const { return value > other.value; }
+};
+
+template <class Vector>
+float TimeRunGeneration(Vector& values, size_t& num_runs, int rounds) {
+    PatienceSorting<typename Vector::iterator> ps;
+    float best = 0;
+    for(int i = 0; i < rounds; i++) {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        num_runs = ps.CountRuns(values.begin(), values.end());
+        auto t1 = std::chrono::high_resolution_clock::now();
+        float ms = chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / 1000.0f;
+        best = (i == 0 || ms < best) ? ms : best;
+    }
+    return best;
+}
+
+// Times the run generation alone for inputs that randomly interleave k ascending sequences, so they split into
+// about k runs and the search for the run of an element cannot be predicted. The second table interleaves
+// 16 sequences in bursts, which the run generation appends without a search.
+int main() {
+
+    const int count = 4000000;
+    const int rounds = 3;
+
+    cout << "Run generation of " << count << " integers" << endl;
+    cout << "runs\tlocator ms\tns/elem\tlower_bound ms\tns/elem" << endl;
+
+    for(int k = 1; k <= 4096; k *= 2) {
+        std::mt19937 mt(k);
+        std::uniform_int_distribution<int> dist_run(0, k - 1);
+        vector<int> next(k);
+        vector<int> values(count);
+        vector<BoxedInt> boxed(count);
+        for(int i = 0; i < count; i++) {
+            int run = dist_run(mt);
+            values[i] = run * (count / k) + next[run]++;
+            boxed[i].value = values[i];
+        }
+
+        size_t runs, boxed_runs;
+        float fast = TimeRunGeneration(values, runs, rounds);
+        float generic = TimeRunGeneration(boxed, boxed_runs, rounds);
+
+        cout << runs << "\t" << fast << "\t\t" << fast * 1e6f / count
+             << "\t" << generic << "\t\t" << generic * 1e6f / count << endl;
+    }
+
+    // 16 ascending sequences interleaved in bursts, every burst is one stretch that is appended in bulk
+    cout << "burst\truns\tlocator ms\tns/elem" << endl;
+    const int kStreams = 16;
+    for(int burst = 1; burst <= 4096; burst *= 4) {
+        std::mt19937 mt(burst);
+        std::uniform_int_distribution<int> dist_stream(0, kStreams - 1);
+        vector<int> next(kStreams);
+        vector<int> values(count);
+        for(int i = 0; i < count; ) {
+            const int stream = dist_stream(mt);
+            for(int b = 0; b < burst && i < count; b++, i++) {
+                values[i] = stream * (count / kStreams) + next[stream]++;
+            }
+        }
+
+        size_t runs;
+        float ms = TimeRunGeneration(values, runs, rounds);
+        cout << burst << "\t" << runs << "\t" << ms << "\t\t" << ms * 1e6f / count << endl;
+    }
+
+    return 0;
+}
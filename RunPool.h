@@ -1,98 +1,248 @@
 #ifndef RUNPOOL_H
 #define RUNPOOL_H
 
-#include <bits/stl_iterator_base_types.h>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <utility>
+#include <new>
+#include <cstdlib>
 
+#include "MemoryPolicy.h"
 
-const size_t kValuesPerBlock =    800;
 
+const size_t kMinSlabBlocks =     64;
+const size_t kBlockBytes =        4096;         // a page of values per block
+const size_t kMinBlockValues =    16;           // records of more than 256 bytes get more than a page
+const size_t kSlabAlignment =     64;           // cache line, the SIMD kernels load whole lines
+
+
+// Default number of values per block: the values of a block fill a page. Every run keeps at least one block, so
+// larger blocks would multiply the memory of inputs with many short runs.
 template <typename ValueType>
+struct DefaultBlockSize {
+    static const size_t value = kBlockBytes / sizeof(ValueType) > kMinBlockValues ? kBlockBytes / sizeof(ValueType) : kMinBlockValues;
+};
+
+// The metadata of a block. The values live apart from it in the payload of the slab, so the payload of all
+// blocks is one contiguous aligned array and every block starts at a multiple of its size.
+template <typename ValueType, size_t kBlockSize = DefaultBlockSize<ValueType>::value>
 struct RunBlock {
     RunBlock *next;
     RunBlock *prev;
     int next_free_pos_;
-    ValueType values[kValuesPerBlock];
     bool is_front;
+    ValueType* values;
     RunBlock()
-            : next(NULL), prev(NULL), next_free_pos_(0), is_front(false)
+            : next(NULL), prev(NULL), next_free_pos_(0), is_front(false), values(NULL)
     {}
 
-
+    void Reset() {
+        next = NULL;
+        prev = NULL;
+        next_free_pos_ = 0;
+        is_front = false;
+    }
 };
 
 
-template <typename ValueType>
-class RunPool {
+// Chunked memory arena for the RunBlocks of one sorter. Blocks are handed out by bumping a pointer
+// through the current slab, if it runs out the next slab is used or a new one at least as large as
+// all existing slabs together is allocated. Single blocks that are handed back with Free() are reused first,
+// Recycle() hands all blocks back without freeing the memory. The metadata of the blocks of a slab is one array,
+// their values another one that is aligned to a cache line, or to a hugepage if the slab is large enough.
+// The values of the slabs are allocated as the MemoryPolicy of the arena says.
+template <typename ValueType, size_t kBlockSize = DefaultBlockSize<ValueType>::value>
+class BlockArena {
+public:
+    BlockArena()
+            : slab_(0), next_free_(NULL), slab_end_(NULL), free_list_(NULL), capacity_(0), used_(0), peak_(0), allocated_(0)
+    {}
 
-    class iterator
-    {
-    public:
-        typedef iterator            self_type;
-        typedef ValueType           value_type;
-        typedef ValueType&          reference;
-        typedef ValueType*          pointer;
-        typedef size_t              difference_type;
-        typedef std::bidirectional_iterator_tag iterator_category;
-
-        iterator(RunBlock<ValueType>* block, size_t index) : block_(block), index_(index) {}
-
-        self_type&  operator++() {      // prefix
-            index_++;
-            if(index_ >= kValuesPerBlock) {
-                index_ -= kValuesPerBlock;
-                block_ = block_->next;
-                return *this;
-            }
-            return *this;
-        }
-        self_type&  operator++(int i) {     // postfix
-            self_type& temp = *this;
-            index_++;
-            if(index_ >= kValuesPerBlock) {
-                index_ -= kValuesPerBlock;
-                block_ = block_->next;
-                return temp;
-            }
-            return temp;
+    ~BlockArena() {
+        FreeSlabs();
+    }
+
+    BlockArena(const BlockArena&) =             delete;
+    BlockArena& operator=(const BlockArena&) =  delete;
+
+    typedef RunBlock<ValueType, kBlockSize>     Block;
+
+
+    // make sure that at least s blocks can be fetched without growing, only valid while no block is in use
+    void Reserve(size_t s) {
+        if(s <= capacity_ || used_ > 0) {
+            return;
         }
-        self_type&  operator--() {
-            index_--;
-            if(index_ < 0) {
-                index_ += kValuesPerBlock;
-                block_ = block_->prev;
-            }
-            return *this;
-        }
-        self_type&  operator--(int i) {
-            self_type& temp = *this;
-            index_--;
-            if(index_ < 0) {
-                index_ += kValuesPerBlock;
-                block_ = block_->prev;
+        FreeSlabs();
+        AddSlab(s);
+        Rewind();
+    }
+
+    // Fetch a new memory block from the arena
+    Block* Alloc() {
+        Block* ret;
+        if(free_list_ != NULL) {
+            ret = free_list_;
+            free_list_ = free_list_->next;
+        } else {
+            if(next_free_ == slab_end_) {
+                Grow();
             }
-            return temp;
+            ret = next_free_;
+            next_free_++;
         }
-        reference   operator*() {
-            return block_->values[index_];
+        used_++;
+        allocated_++;
+        ret->Reset();
+        return ret;
+    }
+
+    // hand a single block back, e.g. as soon as the merge phase has consumed it
+    void Free(Block* block) {
+        peak_ = std::max(peak_, used_);
+        used_--;
+        block->next = free_list_;
+        free_list_ = block;
+    }
+
+    // hand all blocks back to the arena, the slabs are merged into one so the next sort
+    // can bump through a single contiguous slab
+    void Recycle() {
+        peak_ = std::max(peak_, used_);
+        if(slabs_.size() > 1) {
+            size_t capacity = capacity_;
+            FreeSlabs();
+            AddSlab(capacity);
         }
-        pointer     operator->() {
-            return &block_->values[index_];
+        Rewind();
+    }
+
+    // free all slabs, e.g. after an unusually large sort, only valid while no block is in use
+    void Release() {
+        if(used_ > 0) {
+            return;
         }
-        bool        operator==(const self_type& rhs) {
-            return &block_->values[index_] == &rhs.block_[rhs.index_];
+        FreeSlabs();
+        Rewind();
+    }
+
+    // memory held by the slabs, the values and the block headers
+    size_t Bytes() const {
+        return capacity_ * (kBlockSize * sizeof(ValueType) + sizeof(Block));
+    }
+
+    size_t UsedBlocks() const {
+        return used_;
+    }
+
+    // highest number of blocks in use at the same time, updated when the arena is recycled
+    size_t PeakBlocks() const {
+        return std::max(peak_, used_);
+    }
+
+    // number of Alloc() calls over the lifetime of the arena
+    size_t Allocated() const {
+        return allocated_;
+    }
+
+    size_t Capacity() const {
+        return capacity_;
+    }
+
+    // hugepages, NUMA placement and prefault threads of the slabs that are allocated from now on
+    void SetMemoryPolicy(const MemoryPolicy& policy) {
+        policy_ = policy;
+    }
+
+    const MemoryPolicy& GetMemoryPolicy() const {
+        return policy_;
+    }
+
+
+private:
+    struct Slab {
+        Block* blocks;
+        ValueType* values;
+        size_t size;
+        MemoryRegion memory;
+    };
+
+    std::vector<Slab> slabs_;
+    size_t slab_;
+    Block* next_free_;
+    Block* slab_end_;
+    Block* free_list_;       // blocks handed back by Free(), linked by next
+    size_t capacity_;
+    size_t used_;
+    size_t peak_;
+    size_t allocated_;
+    MemoryPolicy policy_;
+
+    void Grow() {
+        const size_t next_slab = slabs_.empty() ? 0 : slab_ + 1;      // an arena without Reserve() has no slab yet
+        if(next_slab >= slabs_.size()) {
+            AddSlab(std::max(kMinSlabBlocks, capacity_));
         }
-        bool        operator!=(const self_type& rhs) {
-            return &block_->values[index_] != &rhs.block_->values[rhs.index_];
+        slab_ = next_slab;
+        next_free_ = slabs_[slab_].blocks;
+        slab_end_ = next_free_ + slabs_[slab_].size;
+    }
+
+    void AddSlab(size_t s) {
+        Slab slab;
+        slab.memory = AllocateMemory(s * kBlockSize * sizeof(ValueType), kSlabAlignment, policy_);
+        slab.values = static_cast<ValueType*>(slab.memory.data);
+        ConstructElements(slab.values, s * kBlockSize, policy_);
+        slab.blocks = new Block[s];
+        for(size_t i = 0; i < s; i++) {
+            slab.blocks[i].values = slab.values + i * kBlockSize;
         }
+        slab.size = s;
+        slabs_.push_back(slab);
+        capacity_ += s;
+    }
 
-        RunBlock<ValueType>*    block_;
-        size_t                  index_;
-    };
+    void Rewind() {
+        slab_ = 0;
+        used_ = 0;
+        free_list_ = NULL;
+        if(slabs_.empty()) {
+            next_free_ = slab_end_ = NULL;
+        } else {
+            next_free_ = slabs_[0].blocks;
+            slab_end_ = next_free_ + slabs_[0].size;
+        }
+    }
 
+    void FreeSlabs() {
+        for(size_t i = 0; i < slabs_.size(); i++) {
+            for(size_t v = 0; v < slabs_[i].size * kBlockSize; v++) {
+                slabs_[i].values[v].~ValueType();
+            }
+            FreeMemory(slabs_[i].memory);
+            delete[] slabs_[i].blocks;
+        }
+        slabs_.clear();
+        capacity_ = 0;
+        next_free_ = slab_end_ = free_list_ = NULL;
+    }
+};
+
+
+template <typename ValueType, size_t kBlockSize = DefaultBlockSize<ValueType>::value>
+class RunPool {
+    typedef RunBlock<ValueType, kBlockSize>     Block;
+    typedef BlockArena<ValueType, kBlockSize>   Arena;
 
 public:
-    RunPool() {
-        begin_back_ = Alloc();
+    RunPool()
+            : arena_(NULL), begin_back_(NULL), end_back_(NULL), begin_front_(NULL), end_front_(NULL),
+              end_block_(NULL), size_(0)
+    {}
+
+    explicit RunPool(Arena* arena) : arena_(arena) {
+        begin_back_ = arena_->Alloc();
         end_back_ = begin_back_;
         size_ = 0;
         begin_front_ = end_front_ = NULL;
@@ -106,47 +256,49 @@ public:
     RunPool& operator=(RunPool&&) =         default;
 
 
-    void Add(ValueType &value) {
-        if(end_back_->next_free_pos_ < kValuesPerBlock) {
-            end_back_->values[end_back_->next_free_pos_] = value;
-        } else {
-            RunBlock<ValueType>* temp = Alloc();
-            temp->values[0] = value;
-            temp->prev = end_back_;
-            end_back_->next = temp;
-            end_back_ = temp;
-            end_block_ = temp;
-            size_ += kValuesPerBlock;
-        }
-        end_back_->next_free_pos_++;
+    // the value is moved into the run if it is passed as an rvalue, returns the stored element
+    template <typename V>
+    ValueType& Add(V&& value) {
+        Block* block = BackBlock();
+        ValueType& slot = block->values[block->next_free_pos_];
+        slot = std::forward<V>(value);
+        block->next_free_pos_++;
+        return slot;
     }
 
-
-    void AddFront(ValueType &value) {
-        if(begin_front_ == NULL) {
-            begin_front_ = Alloc();
-            begin_front_->next_free_pos_ = kValuesPerBlock - 1;
-            begin_front_->is_front = true;
-            begin_front_->next = begin_back_;
-
-            end_front_ = begin_front_;
-            begin_back_->prev = end_front_;
+    // Append the ascending range [first, last) with one bulk copy per block, move iterators move it
+    template <class It>
+    void Append(It first, It last) {
+        while(first != last) {
+            Block* block = BackBlock();
+            const size_t count = std::min<size_t>(kBlockSize - block->next_free_pos_, std::distance(first, last));
+            const It stop = std::next(first, count);
+            std::copy(first, stop, block->values + block->next_free_pos_);
+            block->next_free_pos_ += count;
+            first = stop;
         }
+    }
 
-        if(begin_front_->next_free_pos_ < 0) {
-            RunBlock<ValueType>* temp = Alloc();
-            temp->is_front = true;
-            temp->next = begin_front_;
-            temp->values[kValuesPerBlock - 1] = value;
-            temp->next_free_pos_ = kValuesPerBlock - 2;
-
-            begin_front_->prev = temp;
-            begin_front_ = temp;
-            size_ += kValuesPerBlock;
+    template <typename V>
+    ValueType& AddFront(V&& value) {
+        Block* block = FrontBlock();
+        ValueType& slot = block->values[block->next_free_pos_];
+        slot = std::forward<V>(value);
+        block->next_free_pos_--;
+        return slot;
+    }
 
-        } else {
-            begin_front_->values[begin_front_->next_free_pos_] = value;
-            begin_front_->next_free_pos_--;
+    // Put the descending range [first, last) in front of the run, so *(last - 1) becomes the head. Each block is
+    // filled towards its start with one bulk copy.
+    template <class It>
+    void Prepend(It first, It last) {
+        while(first != last) {
+            Block* block = FrontBlock();
+            const size_t count = std::min<size_t>(block->next_free_pos_ + 1, std::distance(first, last));
+            const It stop = std::next(first, count);
+            std::copy(first, stop, std::reverse_iterator<ValueType*>(block->values + block->next_free_pos_ + 1));
+            block->next_free_pos_ -= count;
+            first = stop;
         }
     }
 
@@ -155,96 +307,187 @@ public:
         size_total += end_back_->next_free_pos_;
 
         if(begin_front_ != NULL) {
-            size_total +=  kValuesPerBlock - begin_front_->next_free_pos_ - 1;
+            size_total +=  kBlockSize - begin_front_->next_free_pos_ - 1;
         }
         return size_total;
     }
 
-    ValueType& operator[](size_t t) {
-        RunBlock<ValueType>* temp = begin_back_;
-        while(t >= kValuesPerBlock) {
-            temp = temp->next;
-            t -= kValuesPerBlock;
-        }
-        return temp->values[t];
+    // The run as a chain of contiguous pieces, one per block: the front blocks first, then the back blocks
+    Block* first_block() const {
+        return begin_front_ != NULL ? begin_front_ : begin_back_;
     }
 
-    iterator begin() {
-        if(begin_front_ == NULL) {
-            return iterator(begin_back_, 0);
-        } else {
-            return iterator(begin_front_, begin_front_->next_free_pos_ + 1);
-        }
-
+    static ValueType* block_begin(Block* block) {
+        return block->is_front ? block->values + block->next_free_pos_ + 1 : block->values;
     }
 
-    iterator end() {        // points to the last element plus one
-        if(end_block_->next_free_pos_>= kValuesPerBlock) {
-            return iterator(end_block_, kValuesPerBlock);
-        }
-        return iterator(end_block_, end_block_->next_free_pos_);
+    static ValueType* block_end(Block* block) {
+        return block->is_front ? block->values + kBlockSize : block->values + block->next_free_pos_;
+    }
 
+    Arena* arena() const {
+        return arena_;
     }
 
-    iterator last() {       // points to the last element
-        if(end_block_->next_free_pos_ > 0) {
-            return iterator(end_block_, end_block_->next_free_pos_ - 1);
-        } else {
-            return iterator(end_block_->prev, kValuesPerBlock - 1);
+    // Move the first count elements to the empty run front, the rest stays in place. The blocks in front of the
+    // split become front blocks of front, the elements in front of the split in its own block are moved to front.
+    void SplitFront(size_t count, RunPool& front) {
+        const size_t taken = count;
+        const size_t remaining = size() - count;
+        Block* block = first_block();
+        while(count > 0 && count >= static_cast<size_t>(block_end(block) - block_begin(block))) {
+            count -= block_end(block) - block_begin(block);
+            if(!block->is_front) {
+                block->is_front = true;
+                block->next_free_pos_ = -1;
+            }
+            if(front.begin_front_ == NULL) {
+                front.begin_front_ = block;
+            }
+            front.end_front_ = block;
+            block = block->next;
         }
+        if(front.end_front_ != NULL) {
+            front.end_front_->next = front.begin_back_;
+            front.begin_back_->prev = front.end_front_;
+        }
+        ValueType* pos = block_begin(block) + count;
+        front.Append(std::make_move_iterator(block_begin(block)), std::make_move_iterator(pos));
+        front.SetSize(taken);
+        DropFront(block, pos, remaining);
+    }
+
+    ValueType& front() {
+        return *block_begin(first_block());
     }
 
     ValueType&back() {
         int next_free = end_block_->next_free_pos_;
         if(next_free <= 0) {
-            return end_block_->prev->values[kValuesPerBlock - 1];
+            return end_block_->prev->values[kBlockSize - 1];
         } else {
             return end_block_->values[next_free - 1];
         }
     }
 
-    static void SetMemSize(size_t s) {
-        mem_blocks_ = s;
+private:
+    // size_ from the number of elements, it counts the blocks between the first front and the last back block
+    void SetSize(size_t total) {
+        size_ = total - end_back_->next_free_pos_;
+        if(begin_front_ != NULL) {
+            size_ -= kBlockSize - begin_front_->next_free_pos_ - 1;
+        }
     }
 
-    static void Init() {
-        memory_ = new RunBlock<ValueType>[mem_blocks_];
-        next_free_ = memory_;
+    // Drop the elements in front of pos, the blocks in front of block are gone, remaining elements are left.
+    // A back block that is not the last one becomes a front block, the elements of the last block are moved
+    // to its start.
+    void DropFront(Block* block, ValueType* pos, size_t remaining) {
+        block->prev = NULL;
+        if(!block->is_front && block != end_back_) {
+            block->is_front = true;
+            begin_back_ = block->next;
+            end_front_ = block;
+        }
+        if(block->is_front) {
+            block->next_free_pos_ = static_cast<int>(pos - block->values) - 1;
+            begin_front_ = block;
+        } else {
+            if(pos != block->values) {
+                std::move(pos, block->values + block->next_free_pos_, block->values);
+            }
+            block->next_free_pos_ = static_cast<int>(remaining);
+            begin_back_ = block;
+            begin_front_ = end_front_ = NULL;
+        }
+        SetSize(remaining);
     }
 
-    static void Release() {
-        delete[] memory_;
+    // the last back block, a new one if it is full
+    Block* BackBlock() {
+        if(end_back_->next_free_pos_ >= static_cast<int>(kBlockSize)) {
+            Block* temp = arena_->Alloc();
+            temp->prev = end_back_;
+            end_back_->next = temp;
+            end_back_ = temp;
+            end_block_ = temp;
+            size_ += kBlockSize;
+        }
+        return end_back_;
     }
 
-    static RunBlock<ValueType>* Alloc() {
-        RunBlock<ValueType>* ret = next_free_;
-        next_free_++;
-        return ret;
-    }
+    // the first front block, a new one if it is full or the run has none yet
+    Block* FrontBlock() {
+        if(begin_front_ == NULL) {
+            begin_front_ = arena_->Alloc();
+            begin_front_->next_free_pos_ = kBlockSize - 1;
+            begin_front_->is_front = true;
+            begin_front_->next = begin_back_;
 
+            end_front_ = begin_front_;
+            begin_back_->prev = end_front_;
+        }
 
+        if(begin_front_->next_free_pos_ < 0) {
+            Block* temp = arena_->Alloc();
+            temp->is_front = true;
+            temp->next = begin_front_;
+            temp->next_free_pos_ = kBlockSize - 1;
 
+            begin_front_->prev = temp;
+            begin_front_ = temp;
+            size_ += kBlockSize;
+        }
+        return begin_front_;
+    }
 
-private:
-    RunBlock<ValueType>* begin_back_;
-    RunBlock<ValueType>* end_back_;
-    RunBlock<ValueType>* begin_front_;
-    RunBlock<ValueType>* end_front_;
-    RunBlock<ValueType>* end_block_;
+    Arena* arena_;
+    Block* begin_back_;
+    Block* end_back_;
+    Block* begin_front_;
+    Block* end_front_;
+    Block* end_block_;
     size_t size_;
-
-    static RunBlock<ValueType>* memory_;
-    static RunBlock<ValueType>* next_free_;
-    static size_t mem_blocks_;
 };
 
-template <typename ValueType>
-RunBlock<ValueType>* RunPool<ValueType>::memory_ = NULL;
 
-template <typename ValueType>
-RunBlock<ValueType>* RunPool<ValueType>::next_free_ = NULL;
 
-template <typename ValueType>
-size_t RunPool<ValueType>::mem_blocks_;
+// Reads the elements of a run block by block and hands every block back to its arena as soon as it is
+// consumed. A cursor without run reads a single contiguous range.
+template <typename ValueType, size_t kBlockSize = DefaultBlockSize<ValueType>::value>
+struct BlockCursor {
+    typedef RunBlock<ValueType, kBlockSize>     Block;
+    typedef RunPool<ValueType, kBlockSize>      Run;
+
+    ValueType* pos;
+    ValueType* end;             // end of the contiguous piece pos points into
+    Block* block;
+    BlockArena<ValueType, kBlockSize>* arena;
+
+    BlockCursor(ValueType* first, ValueType* last) : pos(first), end(last), block(NULL), arena(NULL) { }
+
+    explicit BlockCursor(Run& run) : block(run.first_block()), arena(run.arena()) {
+        pos = Run::block_begin(block);
+        end = Run::block_end(block);
+        Advance();
+    }
+
+    bool done() const {
+        return pos == end;
+    }
+
+    // move on to the next block with elements once the current piece is consumed
+    void Advance() {
+        while(pos == end && block != NULL) {
+            Block* next = block->next;
+            arena->Free(block);
+            block = next;
+            if(block != NULL) {
+                pos = Run::block_begin(block);
+                end = Run::block_end(block);
+            }
+        }
+    }
+};
 
 #endif
@@ -0,0 +1,231 @@
+#ifndef RUNSEARCH_H
+#define RUNSEARCH_H
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+
+#include "SimdMerge.h"
+
+
+const size_t kLinearRunSearch = 64;      // up to this number of runs the run is found by a linear scan
+
+
+// Locating the run for the next element during run generation. lasts_ is sorted descending, so the run to
+// append to is the first one whose last element is <= value, that is the number of lasts > value.
+// heads_ is sorted ascending, the run to prepend to is the first one whose head is >= value.
+// For arithmetic keys and few runs all entries are compared with a linear SIMD scan, for more runs a
+// branchless binary search is used. Other types and comparators use std::lower_bound.
+
+
+// first position in [base, base + n) for which before is false, before is true for a prefix of the range.
+// The loop compiles to conditional moves, so it does not suffer from mispredicted branches.
+template <typename T, class Before>
+size_t BranchlessLowerBound(const T* base, size_t n, Before before) {
+    if(n == 0) {
+        return 0;
+    }
+    const T* first = base;
+    while(n > 1) {
+        const size_t half = n / 2;
+        first = before(first[half]) ? first + half : first;
+        n -= half;
+    }
+    return (first - base) + before(*first);
+}
+
+// count the elements x with less(x, value) (kGreater = false) or less(value, x) (kGreater = true)
+template <bool kGreater, typename T>
+size_t CountScalar(const T* p, size_t n, T value) {
+    size_t count = 0;
+    for(size_t i = 0; i < n; i++) {
+        count += kGreater ? (value < p[i]) : (p[i] < value);
+    }
+    return count;
+}
+
+#ifdef PS_X86_SIMD
+
+// comparison masks of the key types, one bit per lane
+struct Avx2CountInt32 {
+    typedef int32_t Type;
+    static const size_t kLanes = 8;
+    PS_TARGET_AVX2 static int Greater(const Type* p, Type v) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, _mm256_set1_epi32(v))));
+    }
+    PS_TARGET_AVX2 static int Less(const Type* p, Type v) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(v), x)));
+    }
+};
+
+struct Avx2CountUint32 {
+    typedef uint32_t Type;
+    static const size_t kLanes = 8;
+    PS_TARGET_AVX2 static __m256i Flip(__m256i x) {
+        return _mm256_xor_si256(x, _mm256_set1_epi32(static_cast<int>(0x80000000u)));
+    }
+    PS_TARGET_AVX2 static int Greater(const Type* p, Type v) {
+        __m256i x = Flip(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, Flip(_mm256_set1_epi32(static_cast<int>(v))))));
+    }
+    PS_TARGET_AVX2 static int Less(const Type* p, Type v) {
+        __m256i x = Flip(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(Flip(_mm256_set1_epi32(static_cast<int>(v))), x)));
+    }
+};
+
+struct Avx2CountFloat {
+    typedef float Type;
+    static const size_t kLanes = 8;
+    PS_TARGET_AVX2 static int Greater(const Type* p, Type v) {
+        return _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p), _mm256_set1_ps(v), _CMP_GT_OQ));
+    }
+    PS_TARGET_AVX2 static int Less(const Type* p, Type v) {
+        return _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p), _mm256_set1_ps(v), _CMP_LT_OQ));
+    }
+};
+
+struct Avx2CountInt64 {
+    typedef int64_t Type;
+    static const size_t kLanes = 4;
+    PS_TARGET_AVX2 static int Greater(const Type* p, Type v) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, _mm256_set1_epi64x(v))));
+    }
+    PS_TARGET_AVX2 static int Less(const Type* p, Type v) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(v), x)));
+    }
+};
+
+struct Avx2CountUint64 {
+    typedef uint64_t Type;
+    static const size_t kLanes = 4;
+    PS_TARGET_AVX2 static __m256i Flip(__m256i x) {
+        return _mm256_xor_si256(x, _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ULL)));
+    }
+    PS_TARGET_AVX2 static int Greater(const Type* p, Type v) {
+        __m256i x = Flip(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+        __m256i w = Flip(_mm256_set1_epi64x(static_cast<long long>(v)));
+        return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, w)));
+    }
+    PS_TARGET_AVX2 static int Less(const Type* p, Type v) {
+        __m256i x = Flip(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+        __m256i w = Flip(_mm256_set1_epi64x(static_cast<long long>(v)));
+        return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(w, x)));
+    }
+};
+
+struct Avx2CountDouble {
+    typedef double Type;
+    static const size_t kLanes = 4;
+    PS_TARGET_AVX2 static int Greater(const Type* p, Type v) {
+        return _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(p), _mm256_set1_pd(v), _CMP_GT_OQ));
+    }
+    PS_TARGET_AVX2 static int Less(const Type* p, Type v) {
+        return _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(p), _mm256_set1_pd(v), _CMP_LT_OQ));
+    }
+};
+
+template <typename T> struct Avx2Count;
+template <> struct Avx2Count<int32_t>   { typedef Avx2CountInt32 Ops; };
+template <> struct Avx2Count<uint32_t>  { typedef Avx2CountUint32 Ops; };
+template <> struct Avx2Count<float>     { typedef Avx2CountFloat Ops; };
+template <> struct Avx2Count<int64_t>   { typedef Avx2CountInt64 Ops; };
+template <> struct Avx2Count<uint64_t>  { typedef Avx2CountUint64 Ops; };
+template <> struct Avx2Count<double>    { typedef Avx2CountDouble Ops; };
+
+template <bool kGreater, typename T>
+PS_TARGET_AVX2 size_t CountAvx2(const T* p, size_t n, T value) {
+    typedef typename Avx2Count<T>::Ops Ops;
+    size_t count = 0;
+    size_t i = 0;
+    for(; i + Ops::kLanes <= n; i += Ops::kLanes) {
+        count += __builtin_popcount(kGreater ? Ops::Greater(p + i, value) : Ops::Less(p + i, value));
+    }
+    return count + CountScalar<kGreater>(p + i, n - i, value);
+}
+
+#endif
+
+template <bool kGreater, typename T>
+size_t CountCompare(const T* p, size_t n, T value, std::true_type) {
+#ifdef PS_X86_SIMD
+    if(n >= Avx2Count<T>::Ops::kLanes && GetSimdLevel() != kSimdNone) {
+        return CountAvx2<kGreater>(p, n, value);
+    }
+#endif
+    return CountScalar<kGreater>(p, n, value);
+}
+
+template <bool kGreater, typename T>
+size_t CountCompare(const T* p, size_t n, T value, std::false_type) {
+    return CountScalar<kGreater>(p, n, value);
+}
+
+
+// arithmetic keys that are ordered by operator< can be searched with the SIMD scan and the branchless search,
+// std::vector<bool> has no data() to scan
+template <typename T, class Compare>
+struct IsFastRunSearch {
+    static const bool value = std::is_arithmetic<T>::value && !std::is_same<T, bool>::value
+                              && std::is_same<Compare, std::less<T>>::value;
+};
+
+
+// index of the first run whose last element is <= value, lasts.size() if there is none
+template <typename T, class Compare>
+size_t FindRunByLast(const std::vector<T>& lasts, const T& value, Compare, std::true_type) {
+    if(lasts.size() <= kLinearRunSearch) {
+        return CountCompare<true>(lasts.data(), lasts.size(), value,
+                                  std::integral_constant<bool, IsSimdMergeType<T>::value>());
+    }
+    return BranchlessLowerBound(lasts.data(), lasts.size(), [value](T last) { return value < last; });
+}
+
+template <typename T, class Compare>
+size_t FindRunByLast(const std::vector<T>& lasts, const T& value, Compare comp, std::false_type) {
+    return std::lower_bound(lasts.begin(), lasts.end(), value, [&comp](const T& v1, const T& v2) { return comp(v2, v1); })
+           - lasts.begin();
+}
+
+template <typename T, class Compare>
+size_t FindRunByLast(const std::vector<T>& lasts, const T& value, Compare comp) {
+    return FindRunByLast(lasts, value, comp, std::integral_constant<bool, IsFastRunSearch<T, Compare>::value>());
+}
+
+template <typename T>
+size_t FindRunByLast(const std::vector<T>& lasts, const T& value) {
+    return FindRunByLast(lasts, value, std::less<T>());
+}
+
+// index of the first run whose head is >= value, heads.size() if there is none
+template <typename T, class Compare>
+size_t FindRunByHead(const std::vector<T>& heads, const T& value, Compare, std::true_type) {
+    if(heads.size() <= kLinearRunSearch) {
+        return CountCompare<false>(heads.data(), heads.size(), value,
+                                   std::integral_constant<bool, IsSimdMergeType<T>::value>());
+    }
+    return BranchlessLowerBound(heads.data(), heads.size(), [value](T head) { return head < value; });
+}
+
+template <typename T, class Compare>
+size_t FindRunByHead(const std::vector<T>& heads, const T& value, Compare comp, std::false_type) {
+    return std::lower_bound(heads.begin(), heads.end(), value, comp) - heads.begin();
+}
+
+template <typename T, class Compare>
+size_t FindRunByHead(const std::vector<T>& heads, const T& value, Compare comp) {
+    return FindRunByHead(heads, value, comp, std::integral_constant<bool, IsFastRunSearch<T, Compare>::value>());
+}
+
+template <typename T>
+size_t FindRunByHead(const std::vector<T>& heads, const T& value) {
+    return FindRunByHead(heads, value, std::less<T>());
+}
+
+#endif
@@ -0,0 +1,330 @@
+#ifndef SIMDMERGE_H
+#define SIMDMERGE_H
+
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+#include <cassert>
+
+#include "MergePath.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PS_X86_SIMD 1
+#include <immintrin.h>
+#define PS_TARGET_AVX2      __attribute__((target("avx2")))
+#define PS_TARGET_AVX512    __attribute__((target("avx512f")))
+#endif
+
+
+// Merge kernels for the arithmetic key types int32, uint32, int64, uint64, float and double.
+// The CPU is checked once at runtime and the widest bitonic merge network it supports is used for integers,
+// otherwise a branchless scalar merge. Equal integers cannot be told apart, so the network does not have to care
+// which run an equal element comes from. Floating point keys always take the scalar merge: -0.0 and 0.0 are equal
+// and a NaN is unordered, but the min and max of the network would return the same operand twice for them.
+
+enum SimdLevel {
+    kSimdNone,
+    kSimdAvx2,
+    kSimdAvx512
+};
+
+inline SimdLevel DetectSimdLevel() {
+#ifdef PS_X86_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) {
+        return kSimdAvx512;
+    }
+    if(__builtin_cpu_supports("avx2")) {
+        return kSimdAvx2;
+    }
+#endif
+    return kSimdNone;
+}
+
+// the result of the CPUID check, it is computed once and only read afterwards
+inline SimdLevel GetSimdLevel() {
+    static const SimdLevel level = DetectSimdLevel();
+    return level;
+}
+
+template <typename T>
+struct IsSimdMergeType {
+    static const bool value = std::is_same<T, int32_t>::value || std::is_same<T, uint32_t>::value
+                              || std::is_same<T, int64_t>::value || std::is_same<T, uint64_t>::value
+                              || std::is_same<T, float>::value || std::is_same<T, double>::value;
+};
+
+// the key types of the bitonic merge network
+template <typename T>
+struct IsVectorMergeType {
+    static const bool value = IsSimdMergeType<T>::value && std::is_integral<T>::value;
+};
+
+
+// Scalar merge without a branch on the outcome of the comparison
+template <typename T>
+T* BranchlessMerge(const T* a, const T* a_end, const T* b, const T* b_end, T* out) {
+    while(a != a_end && b != b_end) {
+        const T one = *a;
+        const T two = *b;
+        const bool take_two = two < one;
+        *out = take_two ? two : one;
+        ++out;
+        a += !take_two;
+        b += take_two;
+    }
+    out = std::copy(a, a_end, out);
+    return std::copy(b, b_end, out);
+}
+
+
+#ifdef PS_X86_SIMD
+
+// The lane layouts provide loads, stores and the shuffles of the bitonic network, MinMax the comparisons.
+// Clean() sorts a bitonic vector by exchanging lanes in distance kLanes / 2, ..., 2, 1.
+
+struct Avx2Lanes32 {
+    typedef __m256i Vec;
+    static const size_t kLanes = 8;
+
+    PS_TARGET_AVX2 static Vec Load(const void* p) {
+        return _mm256_loadu_si256(static_cast<const __m256i*>(p));
+    }
+    PS_TARGET_AVX2 static void Store(void* p, Vec v) {
+        _mm256_storeu_si256(static_cast<__m256i*>(p), v);
+    }
+    PS_TARGET_AVX2 static Vec Reverse(Vec v) {
+        return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+    }
+    template <class MinMax>
+    PS_TARGET_AVX2 static Vec Clean(Vec v) {
+        Vec p = _mm256_permute2x128_si256(v, v, 1);
+        v = _mm256_blend_epi32(MinMax::Min(v, p), MinMax::Max(v, p), 0xF0);
+        p = _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+        v = _mm256_blend_epi32(MinMax::Min(v, p), MinMax::Max(v, p), 0xCC);
+        p = _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1));
+        return _mm256_blend_epi32(MinMax::Min(v, p), MinMax::Max(v, p), 0xAA);
+    }
+};
+
+struct Avx2Lanes64 {
+    typedef __m256i Vec;
+    static const size_t kLanes = 4;
+
+    PS_TARGET_AVX2 static Vec Load(const void* p) {
+        return _mm256_loadu_si256(static_cast<const __m256i*>(p));
+    }
+    PS_TARGET_AVX2 static void Store(void* p, Vec v) {
+        _mm256_storeu_si256(static_cast<__m256i*>(p), v);
+    }
+    PS_TARGET_AVX2 static Vec Reverse(Vec v) {
+        return _mm256_permute4x64_epi64(v, _MM_SHUFFLE(0, 1, 2, 3));
+    }
+    template <class MinMax>
+    PS_TARGET_AVX2 static Vec Clean(Vec v) {
+        Vec p = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 3, 2));
+        v = _mm256_blend_epi32(MinMax::Min(v, p), MinMax::Max(v, p), 0xF0);
+        p = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(2, 3, 0, 1));
+        return _mm256_blend_epi32(MinMax::Min(v, p), MinMax::Max(v, p), 0xCC);
+    }
+};
+
+struct Avx2Int32 {
+    PS_TARGET_AVX2 static __m256i Min(__m256i a, __m256i b) { return _mm256_min_epi32(a, b); }
+    PS_TARGET_AVX2 static __m256i Max(__m256i a, __m256i b) { return _mm256_max_epi32(a, b); }
+};
+
+struct Avx2Uint32 {
+    PS_TARGET_AVX2 static __m256i Min(__m256i a, __m256i b) { return _mm256_min_epu32(a, b); }
+    PS_TARGET_AVX2 static __m256i Max(__m256i a, __m256i b) { return _mm256_max_epu32(a, b); }
+};
+
+// AVX2 has no 64 bit min/max, so they are built from a compare and a blend
+struct Avx2Int64 {
+    PS_TARGET_AVX2 static __m256i Min(__m256i a, __m256i b) {
+        return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b));
+    }
+    PS_TARGET_AVX2 static __m256i Max(__m256i a, __m256i b) {
+        return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b));
+    }
+};
+
+struct Avx2Uint64 {
+    PS_TARGET_AVX2 static __m256i Greater(__m256i a, __m256i b) {
+        const __m256i sign = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ULL));
+        return _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+    }
+    PS_TARGET_AVX2 static __m256i Min(__m256i a, __m256i b) { return _mm256_blendv_epi8(a, b, Greater(a, b)); }
+    PS_TARGET_AVX2 static __m256i Max(__m256i a, __m256i b) { return _mm256_blendv_epi8(b, a, Greater(a, b)); }
+};
+
+struct Avx512Lanes32 {
+    typedef __m512i Vec;
+    static const size_t kLanes = 16;
+
+    PS_TARGET_AVX512 static Vec Load(const void* p) {
+        return _mm512_loadu_si512(p);
+    }
+    PS_TARGET_AVX512 static void Store(void* p, Vec v) {
+        _mm512_storeu_si512(p, v);
+    }
+    PS_TARGET_AVX512 static Vec Reverse(Vec v) {
+        return _mm512_permutexvar_epi32(_mm512_setr_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0), v);
+    }
+    template <class MinMax>
+    PS_TARGET_AVX512 static Vec Step(Vec v, Vec index, __mmask16 upper) {
+        Vec p = _mm512_permutexvar_epi32(index, v);
+        return _mm512_mask_blend_epi32(upper, MinMax::Min(v, p), MinMax::Max(v, p));
+    }
+    template <class MinMax>
+    PS_TARGET_AVX512 static Vec Clean(Vec v) {
+        v = Step<MinMax>(v, _mm512_setr_epi32(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7), 0xFF00);
+        v = Step<MinMax>(v, _mm512_setr_epi32(4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8, 9, 10, 11), 0xF0F0);
+        v = Step<MinMax>(v, _mm512_setr_epi32(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13), 0xCCCC);
+        return Step<MinMax>(v, _mm512_setr_epi32(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14), 0xAAAA);
+    }
+};
+
+struct Avx512Lanes64 {
+    typedef __m512i Vec;
+    static const size_t kLanes = 8;
+
+    PS_TARGET_AVX512 static Vec Load(const void* p) {
+        return _mm512_loadu_si512(p);
+    }
+    PS_TARGET_AVX512 static void Store(void* p, Vec v) {
+        _mm512_storeu_si512(p, v);
+    }
+    PS_TARGET_AVX512 static Vec Reverse(Vec v) {
+        return _mm512_permutexvar_epi64(_mm512_setr_epi64(7, 6, 5, 4, 3, 2, 1, 0), v);
+    }
+    template <class MinMax>
+    PS_TARGET_AVX512 static Vec Step(Vec v, Vec index, __mmask8 upper) {
+        Vec p = _mm512_permutexvar_epi64(index, v);
+        return _mm512_mask_blend_epi64(upper, MinMax::Min(v, p), MinMax::Max(v, p));
+    }
+    template <class MinMax>
+    PS_TARGET_AVX512 static Vec Clean(Vec v) {
+        v = Step<MinMax>(v, _mm512_setr_epi64(4, 5, 6, 7, 0, 1, 2, 3), 0xF0);
+        v = Step<MinMax>(v, _mm512_setr_epi64(2, 3, 0, 1, 6, 7, 4, 5), 0xCC);
+        return Step<MinMax>(v, _mm512_setr_epi64(1, 0, 3, 2, 5, 4, 7, 6), 0xAA);
+    }
+};
+
+struct Avx512Int32 {
+    PS_TARGET_AVX512 static __m512i Min(__m512i a, __m512i b) { return _mm512_min_epi32(a, b); }
+    PS_TARGET_AVX512 static __m512i Max(__m512i a, __m512i b) { return _mm512_max_epi32(a, b); }
+};
+
+struct Avx512Uint32 {
+    PS_TARGET_AVX512 static __m512i Min(__m512i a, __m512i b) { return _mm512_min_epu32(a, b); }
+    PS_TARGET_AVX512 static __m512i Max(__m512i a, __m512i b) { return _mm512_max_epu32(a, b); }
+};
+
+struct Avx512Int64 {
+    PS_TARGET_AVX512 static __m512i Min(__m512i a, __m512i b) { return _mm512_min_epi64(a, b); }
+    PS_TARGET_AVX512 static __m512i Max(__m512i a, __m512i b) { return _mm512_max_epi64(a, b); }
+};
+
+struct Avx512Uint64 {
+    PS_TARGET_AVX512 static __m512i Min(__m512i a, __m512i b) { return _mm512_min_epu64(a, b); }
+    PS_TARGET_AVX512 static __m512i Max(__m512i a, __m512i b) { return _mm512_max_epu64(a, b); }
+};
+
+// lane layout and comparisons of every key type, Avx2 and Avx512 select the instruction set
+template <typename T> struct Avx2Ops;
+template <> struct Avx2Ops<int32_t>     { typedef Avx2Lanes32 Lanes; typedef Avx2Int32 MinMax; };
+template <> struct Avx2Ops<uint32_t>    { typedef Avx2Lanes32 Lanes; typedef Avx2Uint32 MinMax; };
+template <> struct Avx2Ops<int64_t>     { typedef Avx2Lanes64 Lanes; typedef Avx2Int64 MinMax; };
+template <> struct Avx2Ops<uint64_t>    { typedef Avx2Lanes64 Lanes; typedef Avx2Uint64 MinMax; };
+
+template <typename T> struct Avx512Ops;
+template <> struct Avx512Ops<int32_t>   { typedef Avx512Lanes32 Lanes; typedef Avx512Int32 MinMax; };
+template <> struct Avx512Ops<uint32_t>  { typedef Avx512Lanes32 Lanes; typedef Avx512Uint32 MinMax; };
+template <> struct Avx512Ops<int64_t>   { typedef Avx512Lanes64 Lanes; typedef Avx512Int64 MinMax; };
+template <> struct Avx512Ops<uint64_t>  { typedef Avx512Lanes64 Lanes; typedef Avx512Uint64 MinMax; };
+
+// Vectorized merge: the two sorted vectors lo and hi are merged by a bitonic network, lo is written and
+// hi is merged with the next vector of the run whose next element is smaller. When one run has less than
+// a full vector left, the elements in hi are given back by co-ranking the written output, and the rest is
+// merged by the scalar kernel. The same body is compiled once for every instruction set.
+#define PS_DEFINE_VECTOR_MERGE(NAME, TARGET, OPS)                                                           \
+template <typename T>                                                                                       \
+TARGET T* NAME(const T* a, const T* a_end, const T* b, const T* b_end, T* out) {                           \
+    typedef typename OPS<T>::Lanes Lanes;                                                                   \
+    typedef typename OPS<T>::MinMax MinMax;                                                                 \
+    typedef typename Lanes::Vec Vec;                                                                        \
+    const ptrdiff_t kLanes = Lanes::kLanes;                                                                 \
+    const T* a_begin = a;                                                                                   \
+    const T* b_begin = b;                                                                                   \
+    T* out_begin = out;                                                                                     \
+                                                                                                            \
+    if(a_end - a >= kLanes && b_end - b >= kLanes) {                                                        \
+        Vec hi = Lanes::Load(a);                                                                            \
+        Vec next = Lanes::Load(b);                                                                          \
+        a += kLanes;                                                                                        \
+        b += kLanes;                                                                                        \
+        while(true) {                                                                                       \
+            next = Lanes::Reverse(next);                                                                    \
+            Vec lo = Lanes::template Clean<MinMax>(MinMax::Min(hi, next));                                  \
+            hi = Lanes::template Clean<MinMax>(MinMax::Max(hi, next));                                      \
+            Lanes::Store(out, lo);                                                                          \
+            out += kLanes;                                                                                  \
+            if(a_end - a < kLanes || b_end - b < kLanes) {                                                  \
+                break;                                                                                      \
+            }                                                                                               \
+            if(*b < *a) {                                                                                   \
+                next = Lanes::Load(b);                                                                      \
+                b += kLanes;                                                                                \
+            } else {                                                                                        \
+                next = Lanes::Load(a);                                                                      \
+                a += kLanes;                                                                                \
+            }                                                                                               \
+        }                                                                                                   \
+        const size_t written = out - out_begin;                                                             \
+        const size_t one = CoRank(written, a_begin, a - a_begin, b_begin, b - b_begin, std::less<T>());     \
+        a = a_begin + one;                                                                                  \
+        b = b_begin + (written - one);                                                                      \
+    }                                                                                                       \
+    return BranchlessMerge(a, a_end, b, b_end, out);                                                        \
+}
+
+PS_DEFINE_VECTOR_MERGE(Avx2Merge, PS_TARGET_AVX2, Avx2Ops)
+PS_DEFINE_VECTOR_MERGE(Avx512Merge, PS_TARGET_AVX512, Avx512Ops)
+
+#undef PS_DEFINE_VECTOR_MERGE
+
+#endif
+
+
+template <typename T>
+T* SimdMerge(const T* a, const T* a_end, const T* b, const T* b_end, T* out, SimdLevel, std::false_type) {
+    return BranchlessMerge(a, a_end, b, b_end, out);
+}
+
+template <typename T>
+T* SimdMerge(const T* a, const T* a_end, const T* b, const T* b_end, T* out, SimdLevel level, std::true_type) {
+#ifdef PS_X86_SIMD
+    if(level == kSimdAvx512) {
+        return Avx512Merge(a, a_end, b, b_end, out);
+    }
+    if(level == kSimdAvx2) {
+        return Avx2Merge(a, a_end, b, b_end, out);
+    }
+#endif
+    (void)level;
+    return BranchlessMerge(a, a_end, b, b_end, out);
+}
+
+// Merge the sorted runs [a, a_end) and [b, b_end) to out with the best kernel of this CPU and return the end
+// of the output. out must not overlap the runs: the vector kernels read the runs again to co-rank their tail.
+template <typename T>
+T* SimdMerge(const T* a, const T* a_end, const T* b, const T* b_end, T* out, SimdLevel level = GetSimdLevel()) {
+    static_assert(IsSimdMergeType<T>::value, "SimdMerge supports 32 and 64 bit integers and floating point types");
+    assert(out + (a_end - a) + (b_end - b) <= a || out >= a_end);
+    assert(out + (a_end - a) + (b_end - b) <= b || out >= b_end);
+    return SimdMerge(a, a_end, b, b_end, out, level, std::integral_constant<bool, IsVectorMergeType<T>::value>());
+}
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef SMALLSORT_H
+#define SMALLSORT_H
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#include "ContiguousIterator.h"
+
+
+// Sorting of small ranges without any setup or heap memory. Arithmetic keys in ascending order of up to
+// kMaxNetworkSize elements go through a sorting network, up to twice as many through 2 networks and a merge.
+// Everything else goes through binary insertion sort if equal elements have to keep their order and through
+// std::sort otherwise, which is faster for random input and does not allocate either.
+// The networks are Batcher's odd-even merge sort of the next power of 2, generated by templates for every size.
+// Comparators that reach behind the last element are left out, which is the same as padding with elements
+// that are larger than all others. Every comparator is a branchless min and max, so there are no mispredictions.
+
+const size_t kMaxNetworkSize = 32;
+
+
+template <size_t kSize>
+struct NetworkWidth {
+    static const size_t value = 2 * NetworkWidth<(kSize + 1) / 2>::value;
+};
+
+template <> struct NetworkWidth<1> { static const size_t value = 1; };
+template <> struct NetworkWidth<0> { static const size_t value = 1; };
+
+// Integers swap through a mask, compilers tend to turn a min and max of them into branches
+template <typename T>
+inline void MinMax(T& x, T& y, std::true_type) {
+    const T mask = (x ^ y) & (T(0) - T(y < x));
+    x ^= mask;
+    y ^= mask;
+}
+
+// Floating point elements are swapped by a select on y < x. A min and max would not be a permutation: both return
+// their first argument for equal keys like -0.0 and 0.0 or for a NaN, which would then be written twice.
+template <typename T>
+inline void MinMax(T& x, T& y, std::false_type) {
+    const bool swap = y < x;
+    const T lo = swap ? y : x;
+    y = swap ? x : y;
+    x = lo;
+}
+
+template <size_t kSize, typename T>
+inline void CompareExchange(T* a, size_t i, size_t j) {
+    if (j < kSize) {
+        T x = a[i];
+        T y = a[j];
+        MinMax(x, y, std::integral_constant<bool, std::is_integral<T>::value>());
+        a[i] = x;
+        a[j] = y;
+    }
+}
+
+// merge of the elements kLo, kLo + kR, ... up to kHi of two sorted halves
+template <size_t kSize, size_t kLo, size_t kHi, size_t kR>
+struct NetworkMerge {
+    static const size_t kStep = 2 * kR;
+
+    template <typename T>
+    static void Apply(T* a) {
+        Apply(a, std::integral_constant<bool, (kLo < kSize && kStep < kHi - kLo)>(), std::integral_constant<bool, (kLo < kSize)>());
+    }
+
+    template <typename T, bool kInRange>
+    static void Apply(T* a, std::true_type, std::integral_constant<bool, kInRange>) {
+        NetworkMerge<kSize, kLo, kHi, kStep>::Apply(a);
+        NetworkMerge<kSize, kLo + kR, kHi, kStep>::Apply(a);
+        for (size_t i = kLo + kR; i + kR < kHi; i += kStep) {
+            CompareExchange<kSize>(a, i, i + kR);
+        }
+    }
+
+    template <typename T>
+    static void Apply(T* a, std::false_type, std::true_type) {
+        CompareExchange<kSize>(a, kLo, kLo + kR);
+    }
+
+    template <typename T>
+    static void Apply(T*, std::false_type, std::false_type) { }
+};
+
+// sort of the elements kLo ... kHi
+template <size_t kSize, size_t kLo, size_t kHi>
+struct NetworkSort {
+    static const size_t kMid = kLo + (kHi - kLo) / 2;
+
+    template <typename T>
+    static void Apply(T* a) {
+        Apply(a, std::integral_constant<bool, (kLo < kHi && kLo + 1 < kSize)>());
+    }
+
+    template <typename T>
+    static void Apply(T* a, std::true_type) {
+        NetworkSort<kSize, kLo, kMid>::Apply(a);
+        NetworkSort<kSize, kMid + 1, kHi>::Apply(a);
+        NetworkMerge<kSize, kLo, kHi, 1>::Apply(a);
+    }
+
+    template <typename T>
+    static void Apply(T*, std::false_type) { }
+};
+
+template <size_t kSize, typename T>
+void SortNetwork(T* a) {
+    NetworkSort<kSize, 0, NetworkWidth<kSize>::value - 1>::Apply(a);
+}
+
+// networks of all sizes up to kMaxNetworkSize, indexed by the size
+template <typename T>
+struct NetworkTable {
+    typedef void (*Network)(T*);
+    Network networks[kMaxNetworkSize + 1];
+
+    NetworkTable() {
+        Fill(std::integral_constant<size_t, kMaxNetworkSize>());
+    }
+
+    template <size_t kSize>
+    void Fill(std::integral_constant<size_t, kSize>) {
+        networks[kSize] = &SortNetwork<kSize, T>;
+        Fill(std::integral_constant<size_t, kSize - 1>());
+    }
+
+    void Fill(std::integral_constant<size_t, 0>) {
+        networks[0] = &SortNetwork<0, T>;
+    }
+};
+
+// sort a[0, n) with n <= kMaxNetworkSize
+template <typename T>
+void SortNetwork(T* a, size_t n) {
+    static const NetworkTable<T> table;
+    table.networks[n](a);
+}
+
+
+// Arithmetic keys ordered by operator< are sorted by networks. They do not keep equal elements in order, which
+// only shows for floating point keys (-0.0 and 0.0), so stable sorting leaves those to binary insertion.
+template <typename T, class Compare>
+struct IsNetworkSort {
+    static const bool value = std::is_arithmetic<T>::value && !std::is_same<T, bool>::value
+                              && std::is_same<Compare, std::less<T>>::value;
+};
+
+
+// [begin, sorted) is sorted, insert every element of [sorted, end) behind its equals
+template <class RAI, class Compare>
+void BinaryInsertionSort(RAI begin, RAI sorted, RAI end, Compare comp) {
+    typedef typename std::iterator_traits<RAI>::value_type ValueType;
+    if (sorted == begin && sorted != end) {
+        ++sorted;
+    }
+    for (; sorted < end; ++sorted) {
+        if (!comp(*sorted, sorted[-1])) {
+            continue;
+        }
+        ValueType value = std::move(*sorted);
+        RAI pos = std::upper_bound(begin, sorted, value, comp);
+        std::move_backward(pos, sorted, sorted + 1);
+        *pos = std::move(value);
+    }
+}
+
+template <class RAI, class Compare>
+void SmallSort(RAI begin, RAI end, Compare comp, bool stable, std::false_type) {
+    if (stable) {
+        BinaryInsertionSort(begin, begin, end, comp);
+    } else {
+        std::sort(begin, end, comp);
+    }
+}
+
+// Up to 2 * kMaxNetworkSize elements are 2 networks and a merge through a buffer on the stack
+template <class RAI, class Compare>
+void SmallSort(RAI begin, RAI end, Compare comp, bool stable, std::true_type) {
+    typedef typename std::iterator_traits<RAI>::value_type ValueType;
+    const size_t n = end - begin;
+    if (n > 2 * kMaxNetworkSize || (stable && std::is_floating_point<ValueType>::value)) {
+        SmallSort(begin, end, comp, stable, std::false_type());
+        return;
+    }
+    ValueType* a = &*begin;
+    if (n <= kMaxNetworkSize) {
+        SortNetwork(a, n);
+        return;
+    }
+    const size_t half = n / 2;
+    SortNetwork(a, half);
+    SortNetwork(a + half, n - half);
+    ValueType buffer[kMaxNetworkSize];
+    std::copy(a, a + half, buffer);
+    size_t i = 0;
+    size_t j = half;
+    size_t dest = 0;
+    while (i < half && j < n) {
+        const bool take_right = a[j] < buffer[i];
+        a[dest++] = take_right ? a[j] : buffer[i];
+        j += take_right;
+        i += !take_right;
+    }
+    std::copy(buffer + i, buffer + half, a + dest);
+}
+
+// Sort a small range in place, stable keeps equal elements in their order. Networks need contiguous elements.
+template <class RAI, class Compare>
+void SmallSort(RAI begin, RAI end, Compare comp, bool stable) {
+    typedef typename std::iterator_traits<RAI>::value_type ValueType;
+    if (end - begin < 2) {
+        return;
+    }
+    SmallSort(begin, end, comp, stable,
+              std::integral_constant<bool, IsNetworkSort<ValueType, Compare>::value && IsContiguousIterator<RAI>::value>());
+}
+
+#endif
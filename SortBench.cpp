@@ -0,0 +1,782 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <cmath>
+#include "PatienceSort.h"
+#include "TimSort.h"
+
+using namespace std;
+
+
+// Benchmark suite: every input pattern and element type is sorted at sizes from --min-size to --max-size
+// (in steps of 10) by std::sort, std::stable_sort, Timsort and Patience Sort. All inputs come from a seeded
+// generator, so the numbers of two runs with the same --seed are comparable. Every result is checked against
+// std::stable_sort. The table goes to stdout, --csv and --json write the same rows to files.
+//
+// SortBench [--min-size N] [--max-size N] [--rounds R] [--seed S] [--csv PATH] [--json PATH]
+
+const size_t kMinTimedElements =    1 << 20;        // small inputs are sorted repeatedly until this many elements
+const size_t kSmallInputs =         1024;           // distinct inputs of the small input benchmark
+const size_t kInterleavedRuns =     16;
+const size_t kSawtoothTeeth =       16;
+
+
+// 16 byte record of a key and its payload, ordered by the key only
+struct Record {
+    int64_t key;
+    int64_t payload;
+    bool operator<(const Record& other) const { return key < other.key; }
+    bool operator==(const Record& other) const { return key == other.key && payload == other.payload; }
+};
+
+template <typename T> T MakeValue(uint64_t key, size_t) { return static_cast<T>(key); }
+template <> double MakeValue<double>(uint64_t key, size_t) { return key * 0.5; }
+template <> Record MakeValue<Record>(uint64_t key, size_t index) { return Record{ static_cast<int64_t>(key), static_cast<int64_t>(index) }; }
+
+template <typename T> bool Equivalent(const T& a, const T& b) { return !(a < b) && !(b < a); }
+
+
+enum Pattern {
+    kSorted, kReversed, kSawtooth, kInterleaved, kOrganPipe, kPerturbed1, kPerturbed10, kRandom, kNumPatterns
+};
+const char* kPatternNames[] = { "sorted", "reversed", "sawtooth", "interleaved", "organ-pipe", "perturbed-1%",
+                                "perturbed-10%", "random" };
+
+vector<uint64_t> GenerateKeys(Pattern pattern, size_t n, uint64_t seed) {
+    std::mt19937_64 mt(seed ^ (n * kNumPatterns + pattern));
+    std::uniform_int_distribution<uint64_t> dist_key(0, n - 1);
+    vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; i++) {
+        keys[i] = i;
+    }
+    switch(pattern) {
+        case kReversed:
+            std::reverse(keys.begin(), keys.end());
+            break;
+        case kSawtooth: {
+            const size_t tooth = std::max<size_t>(1, n / kSawtoothTeeth);
+            for(size_t i = 0; i < n; i++) {
+                keys[i] = i % tooth;
+            }
+            break;
+        }
+        case kInterleaved: {
+            // kInterleavedRuns ascending sequences, the next element comes from a random one
+            std::uniform_int_distribution<size_t> dist_run(0, kInterleavedRuns - 1);
+            vector<uint64_t> next(kInterleavedRuns);
+            for(size_t i = 0; i < n; i++) {
+                const size_t run = dist_run(mt);
+                keys[i] = run * (n / kInterleavedRuns + 1) + next[run]++;
+            }
+            break;
+        }
+        case kOrganPipe:
+            for(size_t i = n / 2; i < n; i++) {
+                keys[i] = n - 1 - i;
+            }
+            break;
+        case kPerturbed1:
+        case kPerturbed10: {
+            const size_t num_randoms = n / (pattern == kPerturbed1 ? 100 : 10);
+            for(size_t i = 0; i < num_randoms; i++) {
+                keys[dist_key(mt)] = dist_key(mt);
+            }
+            break;
+        }
+        case kRandom: {
+            std::uniform_int_distribution<uint64_t> dist_random(0, (uint64_t(1) << 31) - 1);
+            for(size_t i = 0; i < n; i++) {
+                keys[i] = dist_random(mt);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return keys;
+}
+
+
+// one line of the results, the phase times are only measured for Patience Sort
+struct Result {
+    string pattern, type, algorithm, strategy;
+    size_t size;
+    double ns_per_element;
+    double run_generation_ns, merge_ns;         // per element
+    size_t runs;
+    bool ok;
+};
+
+struct Options {
+    size_t min_size = 1000;
+    size_t max_size = 10000000;
+    int rounds = 5;
+    uint64_t seed = 42;
+    string csv_path, json_path;
+};
+
+double Median(vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+// Median over the rounds of the nanoseconds per element of sort(values), the input is copied before every sort
+template <typename T, class SortFunc>
+double TimeSort(const vector<T>& input, int rounds, SortFunc sort, vector<T>& result) {
+    const size_t repeats = std::max<size_t>(1, kMinTimedElements / input.size());
+    vector<double> times;
+    for(int r = 0; r < rounds; r++) {
+        double ns = 0;
+        for(size_t i = 0; i < repeats; i++) {
+            result = input;
+            auto t0 = std::chrono::steady_clock::now();
+            sort(result);
+            auto t1 = std::chrono::steady_clock::now();
+            ns += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+        }
+        times.push_back(ns / (repeats * input.size()));
+    }
+    return Median(times);
+}
+
+template <typename T>
+bool SameOrder(const vector<T>& values, const vector<T>& ref) {
+    return values.size() == ref.size() && std::equal(values.begin(), values.end(), ref.begin(), Equivalent<T>);
+}
+
+template <typename T>
+void BenchmarkInput(const string& pattern, const string& type, const vector<T>& input, const Options& options,
+                    vector<Result>& results) {
+    typedef typename vector<T>::iterator It;
+    const char* strategy_names[] = { "auto", "patience", "natural-merge", "fallback", "radix", "small" };
+    vector<T> ref = input;
+    std::stable_sort(ref.begin(), ref.end());
+    vector<T> sorted;
+
+    Result result;
+    result.pattern = pattern;
+    result.type = type;
+    result.size = input.size();
+    result.run_generation_ns = result.merge_ns = 0;
+    result.runs = 0;
+
+    result.algorithm = "std::sort";
+    result.ns_per_element = TimeSort(input, options.rounds, [](vector<T>& v) { std::sort(v.begin(), v.end()); }, sorted);
+    result.ok = SameOrder(sorted, ref);
+    results.push_back(result);
+
+    result.algorithm = "std::stable_sort";
+    result.ns_per_element = TimeSort(input, options.rounds, [](vector<T>& v) { std::stable_sort(v.begin(), v.end()); }, sorted);
+    result.ok = SameOrder(sorted, ref);
+    results.push_back(result);
+
+    result.algorithm = "timsort";
+    TimSorting<It> tim;
+    result.ns_per_element = TimeSort(input, options.rounds, [&tim](vector<T>& v) { tim.Sort(v.begin(), v.end()); }, sorted);
+    result.ok = SameOrder(sorted, ref);
+    results.push_back(result);
+
+    // the phase times and the number of runs come from a sort with stats after a warm-up sort of the same input
+    result.algorithm = "patience";
+    PatienceSorting<It> ps;
+    result.ns_per_element = TimeSort(input, options.rounds, [&ps](vector<T>& v) { ps.Sort(v.begin(), v.end()); }, sorted);
+    result.ok = SameOrder(sorted, ref);
+    PatienceSorting<It, std::less<T>, DefaultBlockSize<T>::value, SortStats> instrumented;
+    sorted = input;
+    instrumented.Sort(sorted.begin(), sorted.end());
+    sorted = input;
+    const SortStats& stats = instrumented.Sort(sorted.begin(), sorted.end());
+    result.strategy = strategy_names[stats.strategy];
+    result.runs = stats.num_runs;
+    result.run_generation_ns = stats.phase_ns[kPhaseRunGeneration] / double(input.size());
+    result.merge_ns = stats.phase_ns[kPhaseMerge] / double(input.size());
+    results.push_back(result);
+}
+
+template <typename T>
+void BenchmarkType(const string& type, const Options& options, vector<Result>& results) {
+    for(size_t n = options.min_size; n <= options.max_size; n *= 10) {
+        for(int p = 0; p < kNumPatterns; p++) {
+            vector<uint64_t> keys = GenerateKeys(static_cast<Pattern>(p), n, options.seed);
+            vector<T> input(n);
+            for(size_t i = 0; i < n; i++) {
+                input[i] = MakeValue<T>(keys[i], i);
+            }
+            keys = vector<uint64_t>();
+            const size_t first = results.size();
+            BenchmarkInput(kPatternNames[p], type, input, options, results);
+
+            for(size_t i = first; i < results.size(); i++) {
+                const Result& r = results[i];
+                cout << r.type << "\t" << r.size << "\t" << r.pattern << "\t" << r.algorithm << "\t"
+                     << r.ns_per_element << " ns/elem";
+                if(r.algorithm == "patience") {
+                    cout << "\t(" << r.strategy;
+                    if(r.run_generation_ns > 0) {
+                        cout << ", " << r.runs << " runs, run generation " << r.run_generation_ns << " ns/elem, merge "
+                             << r.merge_ns << " ns/elem";
+                    }
+                    cout << ")";
+                }
+                cout << (r.ok ? "" : "\tFAILED") << endl;
+            }
+        }
+    }
+}
+
+
+void WriteCsv(const string& path, const vector<Result>& results, const vector<size_t>& element_sizes) {
+    ofstream out(path.c_str());
+    out << "type,size,pattern,algorithm,strategy,ns_per_element,million_elements_per_s,mb_per_s,"
+           "runs,run_generation_ns_per_element,merge_ns_per_element,ok\n";
+    for(size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        out << r.type << "," << r.size << "," << r.pattern << "," << r.algorithm << "," << r.strategy << ","
+            << r.ns_per_element << "," << 1e3 / r.ns_per_element << "," << element_sizes[i] * 1e3 / r.ns_per_element << ","
+            << r.runs << "," << r.run_generation_ns << "," << r.merge_ns << "," << (r.ok ? 1 : 0) << "\n";
+    }
+}
+
+void WriteJson(const string& path, const vector<Result>& results, const vector<size_t>& element_sizes) {
+    ofstream out(path.c_str());
+    out << "[\n";
+    for(size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        out << "  {\"type\": \"" << r.type << "\", \"size\": " << r.size << ", \"pattern\": \"" << r.pattern
+            << "\", \"algorithm\": \"" << r.algorithm << "\", \"strategy\": \"" << r.strategy
+            << "\", \"ns_per_element\": " << r.ns_per_element
+            << ", \"million_elements_per_s\": " << 1e3 / r.ns_per_element
+            << ", \"mb_per_s\": " << element_sizes[i] * 1e3 / r.ns_per_element
+            << ", \"runs\": " << r.runs << ", \"run_generation_ns_per_element\": " << r.run_generation_ns
+            << ", \"merge_ns_per_element\": " << r.merge_ns << ", \"ok\": " << (r.ok ? "true" : "false")
+            << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+// Many batches of the same size, sorted by a new sorter per batch and by one warm sorter that keeps its arena and
+// merge buffer between the batches
+bool BenchmarkBatches(const Options& options) {
+    typedef vector<int32_t>::iterator It;
+    bool ok = true;
+    cout << "batch\tnew sorter ns/elem\twarm sorter ns/elem" << endl;
+    for(size_t n = 16; n <= std::min<size_t>(options.max_size, 100000); n = n < 100 ? 100 : n * 10) {
+        const size_t num_batches = std::max<size_t>(1, (kMinTimedElements * 4) / n);
+        vector<uint64_t> keys = GenerateKeys(kPerturbed10, n, options.seed);
+        const vector<int32_t> input(keys.begin(), keys.end());
+        vector<int32_t> values;
+
+        auto t0 = std::chrono::steady_clock::now();
+        for(size_t b = 0; b < num_batches; b++) {
+            values = input;
+            PatienceSortFunc(values.begin(), values.end());
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        ok = ok && std::is_sorted(values.begin(), values.end());
+
+        PatienceSorting<It> warm;
+        auto t2 = std::chrono::steady_clock::now();
+        for(size_t b = 0; b < num_batches; b++) {
+            values = input;
+            warm.Sort(values.begin(), values.end());
+        }
+        auto t3 = std::chrono::steady_clock::now();
+        ok = ok && std::is_sorted(values.begin(), values.end());
+
+        const double elements = double(num_batches) * n;
+        cout << n << "\t" << std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / elements << "\t\t\t"
+             << std::chrono::duration_cast<std::chrono::nanoseconds>(t3 - t2).count() / elements << endl;
+    }
+    return ok;
+}
+
+// -0.0, 0.0 and NaN in every fourth element of a floating point input. They are equal or unordered keys, a network
+// that is built from min and max would write one of them twice.
+template <typename T>
+void AddSpecialValues(vector<T>&) { }
+
+void AddSpecialValues(vector<double>& values) {
+    const double special[] = { -0.0, 0.0, std::numeric_limits<double>::quiet_NaN() };
+    for(size_t i = 0; i < values.size(); i += 4) {
+        values[i] = special[(i / 4) % 3];
+    }
+}
+
+// a and b hold the same elements, floating point elements are compared bit by bit
+template <typename T>
+bool SamePermutation(const vector<T>& a, const vector<T>& b) {
+    return a.size() == b.size() && std::is_permutation(a.begin(), a.end(), b.begin());
+}
+
+bool SamePermutation(const vector<double>& a, const vector<double>& b) {
+    vector<uint64_t> bits_a(a.size());
+    vector<uint64_t> bits_b(b.size());
+    memcpy(bits_a.data(), a.data(), a.size() * sizeof(double));
+    memcpy(bits_b.data(), b.data(), b.size() * sizeof(double));
+    std::sort(bits_a.begin(), bits_a.end());
+    std::sort(bits_b.begin(), bits_b.end());
+    return bits_a == bits_b;
+}
+
+// Many sorts of tiny random inputs, the sorting networks and binary insertion against std::sort. Every size up
+// to kSmallSortThreshold is checked stable and unstable, the latter goes through the networks for int32 and double.
+template <class T>
+bool BenchmarkSmall(const char* type_name, const Options& options) {
+    typedef typename vector<T>::iterator It;
+    bool ok = true;
+    PatienceSorting<It> warm;
+    for(size_t n = 0; n <= kSmallSortThreshold; n++) {
+        vector<uint64_t> keys = GenerateKeys(kRandom, n, options.seed + n);
+        vector<T> values(n);
+        for(size_t i = 0; i < n; i++) {
+            values[i] = MakeValue<T>(keys[i] % 32, i);
+        }
+        vector<T> expected = values;
+        std::stable_sort(expected.begin(), expected.end());
+        warm.SetStable(true);
+        warm.Sort(values.begin(), values.end());
+        ok = ok && values == expected;
+
+        // the unstable sort goes through the networks, with special values it only has to keep all elements
+        AddSpecialValues(values);
+        const vector<T> input = values;
+        warm.SetStable(false);
+        warm.Sort(values.begin(), values.end());
+        ok = ok && SamePermutation(values, input);
+    }
+
+    // inputs of 0 and 1 elements report the small sort as well, not the strategy of a larger input before them
+    PatienceSorting<It, std::less<T>, DefaultBlockSize<T>::value, SortStats> reported;
+    for(size_t n = 0; n < 2; n++) {
+        vector<uint64_t> keys = GenerateKeys(kRandom, 1000, options.seed);
+        vector<T> values(keys.size());
+        for(size_t i = 0; i < keys.size(); i++) {
+            values[i] = MakeValue<T>(keys[i], i);
+        }
+        reported.Sort(values.begin(), values.end());
+        const SortStats& stats = reported.Sort(values.begin(), values.begin() + n);
+        ok = ok && reported.Strategy() == kStrategySmall && stats.strategy == kStrategySmall;
+    }
+
+    // the batches cycle through kSmallInputs inputs, so the branch predictor cannot learn a single one
+    cout << type_name;
+    for(size_t n = 4; n <= kSmallSortThreshold; n *= 2) {
+        const size_t num_batches = kMinTimedElements / n;
+        vector<uint64_t> keys = GenerateKeys(kRandom, n * kSmallInputs, options.seed);
+        vector<T> inputs(keys.size());
+        for(size_t i = 0; i < keys.size(); i++) {
+            inputs[i] = MakeValue<T>(keys[i], i);
+        }
+        vector<T> values;
+
+        auto t0 = std::chrono::steady_clock::now();
+        for(size_t b = 0; b < num_batches; b++) {
+            const size_t first = (b % kSmallInputs) * n;
+            values.assign(inputs.begin() + first, inputs.begin() + first + n);
+            std::sort(values.begin(), values.end());
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        warm.SetStable(false);
+        for(size_t b = 0; b < num_batches; b++) {
+            const size_t first = (b % kSmallInputs) * n;
+            values.assign(inputs.begin() + first, inputs.begin() + first + n);
+            warm.Sort(values.begin(), values.end());
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        ok = ok && std::is_sorted(values.begin(), values.end());
+
+        const double elements = double(num_batches) * n;
+        cout << "\t" << std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / elements << " / "
+             << std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count() / elements;
+    }
+    cout << endl;
+    return ok;
+}
+
+// The same keys in a std::vector, a plain array sorted through raw pointers and a std::deque, the last one is
+// not contiguous and moves its runs element by element
+template <class It>
+double TimeContainer(It begin, It end) {
+    auto t0 = std::chrono::steady_clock::now();
+    PatienceSortFunc(begin, end);
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / double(end - begin);
+}
+
+bool BenchmarkContainers(const Options& options) {
+    bool ok = true;
+    const size_t n = options.max_size;
+    cout << "container ns/elem\tvector\tpointer\tdeque" << endl;
+    for(Pattern pattern : { kPerturbed1, kRandom }) {
+        vector<uint64_t> keys = GenerateKeys(pattern, n, options.seed);
+        vector<int32_t> values(keys.begin(), keys.end());
+        std::unique_ptr<int32_t[]> array(new int32_t[n]);
+        std::copy(values.begin(), values.end(), array.get());
+        std::deque<int32_t> deque(values.begin(), values.end());
+
+        const double vector_ns = TimeContainer(values.begin(), values.end());
+        const double pointer_ns = TimeContainer(array.get(), array.get() + n);
+        const double deque_ns = TimeContainer(deque.begin(), deque.end());
+        ok = ok && std::is_sorted(values.begin(), values.end()) && std::equal(values.begin(), values.end(), array.get())
+             && std::equal(values.begin(), values.end(), deque.begin());
+        cout << kPatternNames[pattern] << "\t\t" << vector_ns << "\t" << pointer_ns << "\t" << deque_ns << endl;
+    }
+    return ok;
+}
+
+// -0.0 and 0.0 compare equal but are different values, every merge has to keep all of them. SimdMerge gets
+// 64 of each, the sorter almost sorted inputs with a quarter of zeros of both signs.
+bool CheckSignedZeros(const Options& options) {
+    vector<double> negative(64, -0.0);
+    vector<double> positive(64, 0.0);
+    vector<double> merged(128);
+    SimdMerge(negative.data(), negative.data() + 64, positive.data(), positive.data() + 64, merged.data());
+    bool ok = std::count_if(merged.begin(), merged.end(), [](double v) { return std::signbit(v); }) == 64;
+
+    typedef vector<double>::iterator It;
+    PatienceSorting<It> sorter;
+    sorter.SetStrategy(kStrategyPatience);
+    const size_t n = std::min<size_t>(options.max_size, 1000000);
+    for(uint64_t seed = options.seed; seed < options.seed + 16; seed++) {
+        vector<uint64_t> keys = GenerateKeys(kPerturbed1, n, seed);
+        vector<double> values(n);
+        for(size_t i = 0; i < n; i++) {
+            values[i] = keys[i] < n / 4 ? (keys[i] % 2 ? -0.0 : 0.0) : keys[i] * 0.5;
+        }
+        const long negative_zeros = std::count_if(values.begin(), values.end(), [](double v) { return v == 0 && std::signbit(v); });
+        sorter.Sort(values.begin(), values.end());
+        ok = ok && std::is_sorted(values.begin(), values.end())
+             && std::count_if(values.begin(), values.end(), [](double v) { return v == 0 && std::signbit(v); }) == negative_zeros;
+    }
+    cout << "signed zeros\t" << (ok ? "kept" : "lost") << endl;
+    return ok;
+}
+
+// 56 byte record, every run of the stable run generation keeps at least one block of them
+struct WideRecord {
+    int64_t key;
+    int64_t payload;
+    char padding[40];
+    bool operator<(const WideRecord& other) const { return key < other.key; }
+};
+
+// Stable sorting of records that ascend but for every third one or for 30% in bursts of 8, which come from one
+// descending sequence. Stable run generation would start a run for almost each of them, so the probe has to pick
+// another strategy for 200K of them. A std::deque can not take the natural merge and gets the fallback. 1% perturbed records stay
+// with patience sort. The blocks in use must stay within kStableRunMemory times the size of the input.
+bool CheckStableRuns(const Options& options) {
+    const size_t kStableRunMemory = 4;
+    const char* strategy_names[] = { "auto", "patience", "natural-merge", "fallback", "radix", "small" };
+    const char* input_names[] = { "every third", "bursts", "perturbed-1%" };
+    const size_t n = 200000;
+    std::mt19937_64 mt(options.seed);
+    std::uniform_real_distribution<double> dist_burst(0.0, 1.0);
+    auto same = [](const WideRecord& a, const WideRecord& b) { return a.key == b.key && a.payload == b.payload; };
+    bool ok = true;
+    cout << "stable runs	vector	deque" << endl;
+    for(int input = 0; input < 3; input++) {
+        const vector<uint64_t> perturbed = GenerateKeys(kPerturbed1, n, options.seed);
+        vector<WideRecord> values(n);
+        uint64_t up = 0;
+        uint64_t down = 4 * n;
+        size_t burst = 0;
+        for(size_t i = 0; i < n; i++) {
+            if(input == 1 && burst == 0 && dist_burst(mt) < 0.3 / 8) {
+                burst = 8;
+            }
+            const bool descending = input == 0 ? i % 3 == 2 : burst > 0;
+            values[i].key = input == 2 ? perturbed[i] / 2 : descending ? down-- : up++;
+            values[i].payload = i;
+            burst -= burst > 0;
+        }
+        vector<WideRecord> ref = values;
+        std::stable_sort(ref.begin(), ref.end());
+        std::deque<WideRecord> deque(values.begin(), values.end());
+
+        PatienceSorting<vector<WideRecord>::iterator> sorter;
+        sorter.SetStable(true);
+        sorter.Sort(values.begin(), values.end());
+        PatienceSorting<std::deque<WideRecord>::iterator> deque_sorter;
+        deque_sorter.SetStable(true);
+        deque_sorter.Sort(deque.begin(), deque.end());
+        ok = ok && std::equal(values.begin(), values.end(), ref.begin(), same)
+             && std::equal(deque.begin(), deque.end(), ref.begin(), same)
+             && sorter.PeakBlockUsage() * DefaultBlockSize<WideRecord>::value <= kStableRunMemory * n
+             && deque_sorter.PeakBlockUsage() * DefaultBlockSize<WideRecord>::value <= kStableRunMemory * n;
+        cout << input_names[input] << "\t" << strategy_names[sorter.Strategy()] << "\t"
+             << strategy_names[deque_sorter.Strategy()] << endl;
+    }
+    return ok;
+}
+
+// Inputs of a few long ascending and descending runs: the two halves of an organ pipe and 64 ascending blocks that
+// are reversed each. Most neighbours are descents, but the probe has to find the runs and pick the natural merge,
+// stable or not, instead of the fallback.
+template <typename T>
+bool CheckNaturalRuns(const char* type, const Options& options) {
+    const char* strategy_names[] = { "auto", "patience", "natural-merge", "fallback", "radix", "small" };
+    const char* input_names[] = { "organ-pipe", "reversed-blocks" };
+    const size_t n = std::min<size_t>(options.max_size, 1000000);
+    const size_t block = std::max<size_t>(1, n / 64);
+    bool ok = true;
+    for(int input = 0; input < 2; input++) {
+        vector<uint64_t> keys = GenerateKeys(input == 0 ? kOrganPipe : kSorted, n, options.seed);
+        for(size_t i = 0; input == 1 && i < n; i += block) {
+            std::reverse(keys.begin() + i, keys.begin() + std::min(n, i + block));
+        }
+        vector<T> input_values(n);
+        for(size_t i = 0; i < n; i++) {
+            input_values[i] = MakeValue<T>(keys[i], i);
+        }
+        vector<T> ref = input_values;
+        std::stable_sort(ref.begin(), ref.end());
+        cout << type << " " << input_names[input];
+        for(int stable = 0; stable < 2; stable++) {
+            PatienceSorting<typename vector<T>::iterator> sorter;
+            sorter.SetStable(stable == 1);
+            vector<T> values = input_values;
+            sorter.Sort(values.begin(), values.end());
+            ok = ok && sorter.Strategy() == kStrategyNaturalMerge
+                 && (stable == 1 ? values == ref : std::equal(values.begin(), values.end(), ref.begin(), Equivalent<T>));
+            cout << "\t" << strategy_names[sorter.Strategy()];
+        }
+        cout << endl;
+    }
+    return ok;
+}
+
+// Record that owns its payload and can only be moved. The sorter has to get along without a single copy on every
+// strategy, including the probe of the automatic selection.
+struct MoveOnlyRecord {
+    int64_t key;
+    std::unique_ptr<int64_t> payload;
+    bool operator<(const MoveOnlyRecord& other) const { return key < other.key; }
+};
+
+// Sorts move-only records with every strategy, stable and not, and checks that every payload stayed with its key
+bool CheckMoveOnly(const Options& options) {
+    const SortStrategy strategies[] = { kStrategyAuto, kStrategyPatience, kStrategyNaturalMerge, kStrategyFallback };
+    const size_t n = std::min<size_t>(options.max_size, 100000);
+    const vector<uint64_t> keys = GenerateKeys(kPerturbed10, n, options.seed);
+    bool ok = true;
+    for(int stable = 0; stable < 2; stable++) {
+        for(SortStrategy strategy : strategies) {
+            vector<MoveOnlyRecord> values(n);
+            for(size_t i = 0; i < n; i++) {
+                values[i].key = keys[i];
+                values[i].payload.reset(new int64_t(keys[i]));
+            }
+            PatienceSorting<vector<MoveOnlyRecord>::iterator> sorter;
+            sorter.SetStable(stable == 1);
+            sorter.SetStrategy(strategy);
+            sorter.Sort(values.begin(), values.end());
+            ok = ok && std::is_sorted(values.begin(), values.end())
+                 && std::all_of(values.begin(), values.end(), [](const MoveOnlyRecord& r) { return r.payload && *r.payload == r.key; });
+        }
+    }
+    cout << "move-only records\t" << (ok ? "sorted" : "lost") << endl;
+    return ok;
+}
+
+// std::vector<bool> stores bits behind proxy references, so it has to take the generic path of every strategy
+bool CheckBitVector(const Options& options) {
+    const SortStrategy strategies[] = { kStrategyAuto, kStrategyPatience, kStrategyNaturalMerge, kStrategyFallback,
+                                        kStrategyRadix, kStrategySmall };
+    const size_t n = std::min<size_t>(options.max_size, 100000);
+    const vector<uint64_t> keys = GenerateKeys(kRandom, n, options.seed);
+    bool ok = true;
+    for(int stable = 0; stable < 2; stable++) {
+        for(SortStrategy strategy : strategies) {
+            vector<bool> values(n);
+            for(size_t i = 0; i < n; i++) {
+                values[i] = keys[i] & 1;
+            }
+            const size_t ones = std::count(values.begin(), values.end(), true);
+            PatienceSorting<vector<bool>::iterator> sorter;
+            sorter.SetStable(stable == 1);
+            sorter.SetStrategy(strategy);
+            sorter.Sort(values.begin(), values.end());
+            ok = ok && std::is_sorted(values.begin(), values.end())
+                 && static_cast<size_t>(std::count(values.begin(), values.end(), true)) == ones;
+        }
+    }
+    cout << "vector<bool>\t" << (ok ? "sorted" : "wrong") << endl;
+    return ok;
+}
+
+// The smallest K elements of an almost sorted input: std::partial_sort, a full patience sort, and the partial sort and
+// nth element of patience sort, which merge only K elements of the runs
+bool BenchmarkTopK(const Options& options) {
+    bool ok = true;
+    const size_t n = options.max_size;
+    vector<uint64_t> keys = GenerateKeys(kPerturbed1, n, options.seed);
+    const vector<int32_t> input(keys.begin(), keys.end());
+    vector<int32_t> sorted = input;
+    std::sort(sorted.begin(), sorted.end());
+    vector<int32_t> values;
+    cout << "top k ns/elem\tstd::partial_sort\tpatience sort\tpartial sort\tnth element" << endl;
+    for(size_t k = 10; k < n; k *= 100) {
+        double ns[4];
+        for(int variant = 0; variant < 4; variant++) {
+            values = input;
+            auto t0 = std::chrono::steady_clock::now();
+            if(variant == 0) {
+                std::partial_sort(values.begin(), values.begin() + k, values.end());
+            } else if(variant == 1) {
+                PatienceSortFunc(values.begin(), values.end());
+            } else if(variant == 2) {
+                PatiencePartialSort(values.begin(), values.begin() + k, values.end());
+            } else {
+                PatienceNthElement(values.begin(), values.begin() + k - 1, values.end());
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            ns[variant] = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / double(n);
+            ok = ok && (variant == 3 ? values[k - 1] == sorted[k - 1] : std::equal(values.begin(), values.begin() + k, sorted.begin()));
+        }
+        cout << k << "\t\t" << ns[0] << "\t\t\t" << ns[1] << "\t\t" << ns[2] << "\t\t" << ns[3] << endl;
+    }
+    return ok;
+}
+
+// One sort by a new sorter, which allocates and faults in its arena and merge buffer, and one by the same sorter
+// afterwards, for every memory policy. Explicit hugepages fall back to madvise without a reserved pool, the
+// NUMA placements to first touch without libnuma.
+bool BenchmarkMemory(const Options& options) {
+    typedef vector<int32_t>::iterator It;
+    struct NamedPolicy {
+        const char* name;
+        HugePageMode huge_pages;
+        NumaPlacement numa;
+        size_t prefault_threads;
+    };
+    const NamedPolicy policies[] = {
+        { "default", kHugePagesOff, kNumaFirstTouch, 0 },
+        { "madvise", kHugePagesAdvise, kNumaFirstTouch, 0 },
+        { "hugetlb", kHugePagesExplicit, kNumaFirstTouch, 0 },
+        { "interleave", kHugePagesAdvise, kNumaInterleave, 0 },
+        { "local", kHugePagesAdvise, kNumaLocal, 0 },
+        { "prefault", kHugePagesAdvise, kNumaFirstTouch, std::max(1u, std::thread::hardware_concurrency()) },
+    };
+    bool ok = true;
+    const size_t n = options.max_size;
+    cout << "memory ns/elem" << (NumaSupported() ? "" : " (no NUMA)") << "\tperturbed1% new / warm\trandom new / warm" << endl;
+    for(const NamedPolicy& named : policies) {
+        MemoryPolicy policy;
+        policy.huge_pages = named.huge_pages;
+        policy.numa = named.numa;
+        policy.prefault_threads = named.prefault_threads;
+        cout << named.name;
+        for(Pattern pattern : { kPerturbed1, kRandom }) {
+            vector<uint64_t> keys = GenerateKeys(pattern, n, options.seed);
+            const vector<int32_t> input(keys.begin(), keys.end());
+            vector<int32_t> values = input;
+
+            PatienceSorting<It> sorter;
+            sorter.SetMemoryPolicy(policy);
+            sorter.SetStrategy(kStrategyPatience);
+            auto t0 = std::chrono::steady_clock::now();
+            sorter.Sort(values.begin(), values.end());
+            auto t1 = std::chrono::steady_clock::now();
+            ok = ok && std::is_sorted(values.begin(), values.end());
+            values = input;
+            auto t2 = std::chrono::steady_clock::now();
+            sorter.Sort(values.begin(), values.end());
+            auto t3 = std::chrono::steady_clock::now();
+            ok = ok && std::is_sorted(values.begin(), values.end());
+
+            cout << "\t" << std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / double(n) << " / "
+                 << std::chrono::duration_cast<std::chrono::nanoseconds>(t3 - t2).count() / double(n);
+        }
+        cout << endl;
+    }
+    return ok;
+}
+
+bool ParseOptions(int argc, char** argv, Options& options) {
+    for(int i = 1; i < argc; i++) {
+        const string arg = argv[i];
+        if(i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if(arg == "--min-size") {
+            options.min_size = std::max<size_t>(2, strtoull(value, NULL, 10));
+        } else if(arg == "--max-size") {
+            options.max_size = strtoull(value, NULL, 10);
+        } else if(arg == "--rounds") {
+            options.rounds = std::max(1, atoi(value));
+        } else if(arg == "--seed") {
+            options.seed = strtoull(value, NULL, 10);
+        } else if(arg == "--csv") {
+            options.csv_path = value;
+        } else if(arg == "--json") {
+            options.json_path = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+int main(int argc, char** argv) {
+    Options options;
+    if(!ParseOptions(argc, argv, options)) {
+        cerr << "usage: " << argv[0] << " [--min-size N] [--max-size N] [--rounds R] [--seed S] [--csv PATH] [--json PATH]" << endl;
+        return 2;
+    }
+
+    vector<Result> results;
+    vector<size_t> element_sizes;
+    BenchmarkType<int32_t>("int32", options, results);
+    element_sizes.resize(results.size(), sizeof(int32_t));
+    BenchmarkType<int64_t>("int64", options, results);
+    element_sizes.resize(results.size(), sizeof(int64_t));
+    BenchmarkType<double>("double", options, results);
+    element_sizes.resize(results.size(), sizeof(double));
+    BenchmarkType<Record>("record16", options, results);
+    element_sizes.resize(results.size(), sizeof(Record));
+
+    const bool batches_ok = BenchmarkBatches(options);
+    cout << "small\tns/elem std::sort / patience for 4, 8, 16, 32, 64 elements" << endl;
+    bool small_ok = BenchmarkSmall<int32_t>("int32", options);
+    small_ok = BenchmarkSmall<double>("double", options) && small_ok;
+    small_ok = BenchmarkSmall<Record>("record16", options) && small_ok;
+    const bool containers_ok = BenchmarkContainers(options);
+    const bool top_k_ok = BenchmarkTopK(options);
+    const bool zeros_ok = CheckSignedZeros(options);
+    const bool stable_runs_ok = CheckStableRuns(options);
+    const bool move_only_ok = CheckMoveOnly(options);
+    const bool bit_vector_ok = CheckBitVector(options);
+    cout << "natural runs\tunstable\tstable" << endl;
+    bool natural_runs_ok = CheckNaturalRuns<int64_t>("int64", options);
+    natural_runs_ok = CheckNaturalRuns<Record>("record16", options) && natural_runs_ok;
+    const bool memory_ok = BenchmarkMemory(options);
+
+    if(!options.csv_path.empty()) {
+        WriteCsv(options.csv_path, results, element_sizes);
+    }
+    if(!options.json_path.empty()) {
+        WriteJson(options.json_path, results, element_sizes);
+    }
+
+    bool ok = batches_ok && small_ok && containers_ok && top_k_ok && zeros_ok && stable_runs_ok && move_only_ok
+              && bit_vector_ok && natural_runs_ok && memory_ok;
+    for(size_t i = 0; i < results.size(); i++) {
+        ok = ok && results[i].ok;
+    }
+    cout << (ok ? "All results sorted correctly" : "Some results are not sorted correctly") << endl;
+    return ok ? 0 : 1;
+}
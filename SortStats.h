@@ -0,0 +1,172 @@
+#ifndef SORTSTATS_H
+#define SORTSTATS_H
+
+#include <vector>
+#include <ostream>
+#include <chrono>
+#include <cstdint>
+
+#include "SortStrategy.h"
+
+
+// Instrumentation of PatienceSorting. The sorter calls the hooks of its stats policy at every event, NoSortStats
+// is the default and all of its hooks are empty, so the compiler removes them. SortStats counts everything for
+// one call of Sort(), which returns it.
+
+enum SortPhase {
+    kPhaseProbe,
+    kPhaseRunGeneration,
+    kPhaseMerge,
+    kPhaseFallback,             // the fallback or radix sort of random input
+    kNumPhases
+};
+
+
+struct NoSortStats {
+    static const bool kEnabled = false;
+    typedef int TimePoint;
+
+    void Reset(size_t) { }
+    void SetProbe(const DisorderProbe&, SortStrategy) { }
+    void CountAppend() { }
+    void CountFirstRunHit() { }
+    void CountPrepend() { }
+    void CountNewRun() { }
+    void AddRunGeneration(const NoSortStats&) { }
+    template <class Runs> void SetRuns(const Runs&) { }
+    template <class RunInfos> void SetNaturalRuns(const RunInfos&) { }
+    void AddBlocks(size_t) { }
+    void AddMergePasses(size_t) { }
+    void AddMoved(size_t) { }
+    TimePoint Now() const { return 0; }
+    void AddTime(SortPhase, TimePoint) { }
+    void Finish(TimePoint) { }
+};
+
+
+struct SortStats {
+    static const bool kEnabled = true;
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    size_t num_elements;
+    DisorderProbe probe;                    // the measured sortedness
+    SortStrategy strategy;
+    bool fallback;                          // random input that went to the fallback or radix sort
+    size_t num_runs;
+    std::vector<size_t> run_sizes;          // run_sizes[b] is the number of runs of 2^b to 2^(b+1) - 1 elements
+    size_t appends;                         // elements added behind the last element of a run
+    size_t prepends;                        // elements added in front of the head of a run
+    size_t first_run_hits;                  // appends to the first run without a search
+    size_t blocks_allocated;
+    size_t merge_passes;                    // levels of the merge, every element is moved once per level
+    size_t bytes_moved;                     // by the merge phase, including moving runs out of their blocks
+    uint64_t phase_ns[kNumPhases];
+    uint64_t total_ns;
+
+    SortStats() {
+        Reset(0);
+    }
+
+    void Reset(size_t n) {
+        num_elements = n;
+        probe = DisorderProbe();
+        strategy = kStrategyAuto;
+        fallback = false;
+        num_runs = 0;
+        run_sizes.clear();
+        appends = prepends = first_run_hits = 0;
+        blocks_allocated = merge_passes = bytes_moved = 0;
+        for (size_t p = 0; p < kNumPhases; p++) {
+            phase_ns[p] = 0;
+        }
+        total_ns = 0;
+    }
+
+    void SetProbe(const DisorderProbe& disorder, SortStrategy chosen) {
+        probe = disorder;
+        strategy = chosen;
+        fallback = chosen == kStrategyFallback || chosen == kStrategyRadix;
+    }
+
+    void CountAppend() { appends++; }
+    void CountFirstRunHit() { first_run_hits++; appends++; }
+    void CountPrepend() { prepends++; }
+    void CountNewRun() { appends++; }
+
+    // counters of the run generation of another thread
+    void AddRunGeneration(const SortStats& other) {
+        appends += other.appends;
+        prepends += other.prepends;
+        first_run_hits += other.first_run_hits;
+    }
+
+    template <class Runs>
+    void SetRuns(const Runs& runs) {
+        num_runs = runs.size();
+        for (size_t i = 0; i < runs.size(); i++) {
+            AddRunSize(runs[i]->size());
+        }
+    }
+
+    // the runs the natural merge found in the input
+    template <class RunInfos>
+    void SetNaturalRuns(const RunInfos& run_infos) {
+        num_runs = run_infos.size();
+        for (size_t i = 0; i < run_infos.size(); i++) {
+            AddRunSize(run_infos[i].run_size);
+        }
+    }
+
+    void AddRunSize(size_t size) {
+        size_t bucket = 0;
+        while (size >>= 1) {
+            bucket++;
+        }
+        if (run_sizes.size() <= bucket) {
+            run_sizes.resize(bucket + 1, 0);
+        }
+        run_sizes[bucket]++;
+    }
+
+    void AddBlocks(size_t count) { blocks_allocated += count; }
+    void AddMergePasses(size_t count) { merge_passes += count; }
+    void AddMoved(size_t bytes) { bytes_moved += bytes; }
+
+    TimePoint Now() const {
+        return std::chrono::steady_clock::now();
+    }
+
+    void AddTime(SortPhase phase, TimePoint start) {
+        phase_ns[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(Now() - start).count();
+    }
+
+    void Finish(TimePoint start) {
+        total_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Now() - start).count();
+    }
+};
+
+
+// The stats as one JSON object, e.g. for a log line that the metrics system picks up
+inline std::ostream& operator<<(std::ostream& out, const SortStats& stats) {
+    const char* strategy_names[] = { "auto", "patience", "natural-merge", "fallback", "radix", "small" };
+    out << "{\"num_elements\": " << stats.num_elements
+        << ", \"descents\": " << stats.probe.descents << ", \"runs\": " << stats.probe.runs
+        << ", \"inversions\": " << stats.probe.inversions
+        << ", \"longest_run\": " << stats.probe.longest_run
+        << ", \"strategy\": \"" << strategy_names[stats.strategy] << "\", \"fallback\": " << (stats.fallback ? "true" : "false")
+        << ", \"num_runs\": " << stats.num_runs << ", \"run_sizes\": [";
+    for (size_t b = 0; b < stats.run_sizes.size(); b++) {
+        out << (b > 0 ? ", " : "") << stats.run_sizes[b];
+    }
+    out << "], \"appends\": " << stats.appends << ", \"prepends\": " << stats.prepends
+        << ", \"first_run_hits\": " << stats.first_run_hits << ", \"blocks_allocated\": " << stats.blocks_allocated
+        << ", \"merge_passes\": " << stats.merge_passes << ", \"bytes_moved\": " << stats.bytes_moved
+        << ", \"probe_ns\": " << stats.phase_ns[kPhaseProbe]
+        << ", \"run_generation_ns\": " << stats.phase_ns[kPhaseRunGeneration]
+        << ", \"merge_ns\": " << stats.phase_ns[kPhaseMerge]
+        << ", \"fallback_ns\": " << stats.phase_ns[kPhaseFallback]
+        << ", \"total_ns\": " << stats.total_ns << "}";
+    return out;
+}
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef SORTSTRATEGY_H
+#define SORTSTRATEGY_H
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+#include <cmath>
+
+
+// How an input is sorted, kStrategyAuto picks one from a probe of the input
+enum SortStrategy {
+    kStrategyAuto,
+    kStrategyPatience,          // run generation and merge phase
+    kStrategyNaturalMerge,      // merge the ascending and descending runs that are already in the input
+    kStrategyFallback,          // comparison sort for random input
+    kStrategyRadix,             // LSD radix sort, the fallback of integer and floating point keys
+    kStrategySmall              // small inputs, sorted in place without the heap
+};
+
+
+const size_t kProbeWindows =        64;         // most windows the probe looks at
+const size_t kProbeWindowSize =     512;        // most consecutive elements per window
+const size_t kMinProbeWindow =      32;
+const size_t kMinProbeElements =    256;        // elements in windows, unless the input is smaller
+const size_t kProbeShare =          16;         // the windows cover 1 / kProbeShare of a larger input
+const size_t kProbeSamples =        1024;       // most equally spaced elements for the inversion estimate
+const size_t kMinProbeSamples =     32;
+const size_t kProbeSampleShare =    128;        // one sample per kProbeSampleShare elements
+const size_t kStableRunFactor =     16;         // stable patience sort takes at most this many times sqrt(n) runs
+
+
+// Disorder measures of an input, all relative to its size. They are estimated from windows spread over the
+// input that cover about 1 / kProbeShare of it, and from equally spaced samples.
+struct DisorderProbe {
+    float descents;             // neighbours that are in the wrong order
+    float runs;                 // neighbours that start a new ascending or descending run, about 0.4 for random input
+    float inversions;           // pairs in the wrong order among all pairs, 0.5 for random input, -1 if not estimated
+    float longest_run;          // longest ascending or descending run inside a window relative to the window size
+
+    DisorderProbe() : descents(0.0f), runs(0.0f), inversions(0.0f), longest_run(1.0f) { }
+};
+
+
+// Thresholds of the strategy selection. The defaults are fixed values measured on a typical desktop CPU,
+// CalibrateStrategy() measures them on the machine it runs on.
+struct StrategyThresholds {
+    float max_descents;             // above this the fallback sort is faster than patience sort
+    float max_natural_descents;     // below this the natural runs are merged without run generation
+    float max_natural_runs;         // below this the ascending and descending runs are long enough for the natural merge
+    float min_reversed_descents;    // above this the input is mostly descending and patience sort prepends
+    float max_inversions;           // above this the input counts as random
+
+    StrategyThresholds()
+            : max_descents(0.35f), max_natural_descents(0.0002f), max_natural_runs(0.001f), min_reversed_descents(0.95f),
+              max_inversions(0.4f)
+    { }
+};
+
+
+// Number of neighbours in [first, last) with comp(next, current). Written without branches, so the loop over a
+// contiguous window of arithmetic keys is vectorized by the compiler.
+template <class It, class Compare>
+size_t CountDescents(It first, It last, Compare comp) {
+    size_t count = 0;
+    if (first == last) {
+        return 0;
+    }
+    for (It next = first + 1; next != last; ++first, ++next) {
+        count += comp(*next, *first);
+    }
+    return count;
+}
+
+// Number of runs [first, last) splits into the way NaturalMerge() finds them, ascending stretches and strictly
+// descending ones. The length of the longest run is stored in longest.
+template <class It, class Compare>
+size_t CountMonotoneRuns(It first, It last, Compare comp, size_t& longest) {
+    size_t runs = 0;
+    longest = 0;
+    while (first != last) {
+        It stop = first + 1;
+        if (stop != last && comp(*stop, *first)) {
+            while (stop != last && comp(*stop, stop[-1])) {
+                ++stop;
+            }
+        } else {
+            while (stop != last && !comp(*stop, stop[-1])) {
+                ++stop;
+            }
+        }
+        longest = std::max<size_t>(longest, stop - first);
+        runs++;
+        first = stop;
+    }
+    return runs;
+}
+
+// Number of pairs i < j with comp(values[v[j]], values[v[i]]) among the size indices of v. The indices are merge
+// sorted between v and buffer, which holds size indices as well, so the values are neither copied nor moved.
+template <class RAI, class Compare>
+size_t CountInversions(RAI values, size_t* v, size_t* buffer, size_t size, Compare comp) {
+    size_t inversions = 0;
+    for (size_t width = 1; width < size; width *= 2) {
+        for (size_t lo = 0; lo < size; lo += 2 * width) {
+            const size_t mid = std::min(lo + width, size);
+            const size_t hi = std::min(lo + 2 * width, size);
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                if (comp(values[v[j]], values[v[i]])) {
+                    inversions += mid - i;
+                    buffer[k++] = v[j++];
+                } else {
+                    buffer[k++] = v[i++];
+                }
+            }
+            while (i < mid) {
+                buffer[k++] = v[i++];
+            }
+            while (j < hi) {
+                buffer[k++] = v[j++];
+            }
+        }
+        std::swap(v, buffer);
+    }
+    return inversions;
+}
+
+// Estimate the descents, the runs and the longest run of [begin, end) from windows spread over it. Small inputs get a few
+// short windows, large ones up to kProbeWindows windows of kProbeWindowSize elements.
+template <class RAI, class Compare>
+DisorderProbe ProbeDescents(RAI begin, RAI end, Compare comp) {
+    DisorderProbe probe;
+    const size_t num_elements = std::distance(begin, end);
+    if (num_elements < 2) {
+        return probe;
+    }
+
+    const size_t budget = std::min(std::max(kMinProbeElements, num_elements / kProbeShare),
+                                   kProbeWindows * kProbeWindowSize);
+    const size_t window = std::min(num_elements,
+                                   std::min(std::max(kMinProbeWindow, budget / kProbeWindows), kProbeWindowSize));
+    const size_t num_windows = std::max<size_t>(1, std::min(budget, num_elements) / window);
+    size_t descents = 0;
+    size_t runs = 0;
+    size_t pairs = 0;
+    size_t longest = 0;
+    for (size_t w = 0; w < num_windows; w++) {
+        RAI first = begin + (num_windows == 1 ? 0 : (num_elements - window) * w / (num_windows - 1));
+        RAI last = first + window;
+        descents += CountDescents(first, last, comp);
+        pairs += window - 1;
+        size_t window_longest;
+        runs += CountMonotoneRuns(first, last, comp, window_longest) - 1;
+        longest = std::max(longest, window_longest);
+    }
+    probe.descents = descents / static_cast<float>(pairs);
+    probe.runs = runs / static_cast<float>(pairs);
+    probe.longest_run = longest / static_cast<float>(window);
+    return probe;
+}
+
+// Estimate the share of inversions of [begin, end) from one sample per kProbeSampleShare elements, but at least
+// kMinProbeSamples and at most kProbeSamples. The indices of the samples go into buffer, which is kept by the caller.
+template <class RAI, class Compare>
+void ProbeInversions(RAI begin, RAI end, Compare comp, std::vector<size_t>& buffer, DisorderProbe& probe) {
+    const size_t num_elements = std::distance(begin, end);
+    const size_t share = std::min(std::max(kMinProbeSamples, num_elements / kProbeSampleShare), kProbeSamples);
+    const size_t num_samples = std::min(num_elements, share);
+    if (num_samples < 2) {
+        probe.inversions = 0.0f;
+        return;
+    }
+    buffer.resize(2 * num_samples);
+    for (size_t i = 0; i < num_samples; i++) {
+        buffer[i] = num_elements * i / num_samples;
+    }
+    const size_t sample_pairs = num_samples * (num_samples - 1) / 2;
+    const size_t inversions = CountInversions(begin, buffer.data(), buffer.data() + num_samples, num_samples, comp);
+    probe.inversions = inversions / static_cast<float>(sample_pairs);
+}
+
+// All disorder measures of [begin, end)
+template <class RAI, class Compare>
+DisorderProbe ProbeDisorder(RAI begin, RAI end, Compare comp) {
+    DisorderProbe probe = ProbeDescents(begin, end, comp);
+    std::vector<size_t> buffer;
+    ProbeInversions(begin, end, comp, buffer, probe);
+    return probe;
+}
+
+// true if a probe predicts more runs than stable patience sort should create for num_elements. Stable run
+// generation does not prepend, but puts a descending stretch into one run, so every ascending or descending run of
+// the input can start a run that keeps its blocks until the merge.
+inline bool TooManyStableRuns(const DisorderProbe& probe, size_t num_elements) {
+    return probe.runs * num_elements > kStableRunFactor * std::sqrt(static_cast<float>(num_elements));
+}
+
+// true if the input consists of few long ascending or descending runs, which the natural merge only has to merge
+inline bool FewNaturalRuns(const DisorderProbe& probe, const StrategyThresholds& thresholds) {
+    return probe.descents <= thresholds.max_natural_descents || probe.runs <= thresholds.max_natural_runs;
+}
+
+// true if ChooseStrategy() needs the inversions of a probe, the descents and runs alone decide the other cases
+inline bool NeedsInversions(const DisorderProbe& probe, const StrategyThresholds& thresholds, bool stable,
+                            size_t num_elements) {
+    return !FewNaturalRuns(probe, thresholds)
+           && (stable || probe.descents < thresholds.min_reversed_descents)
+           && probe.descents <= thresholds.max_descents
+           && !(stable && TooManyStableRuns(probe, num_elements));
+}
+
+// Pick the strategy for a probed input of num_elements. Few long runs are merged as they are, whether they ascend or
+// descend, e.g. the two halves of an organ pipe. Stable sorting does not prepend to runs, so mostly descending input
+// goes to the fallback instead, and input with too many runs for patience sort to the natural merge.
+inline SortStrategy ChooseStrategy(const DisorderProbe& probe, const StrategyThresholds& thresholds, bool stable,
+                                   size_t num_elements) {
+    if (FewNaturalRuns(probe, thresholds)) {
+        return kStrategyNaturalMerge;
+    }
+    if (!stable && probe.descents >= thresholds.min_reversed_descents) {
+        return kStrategyPatience;
+    }
+    if (probe.descents > thresholds.max_descents || probe.inversions > thresholds.max_inversions) {
+        return kStrategyFallback;
+    }
+    if (stable && TooManyStableRuns(probe, num_elements)) {
+        return kStrategyNaturalMerge;
+    }
+    return kStrategyPatience;
+}
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef TIMSORT_H
+#define TIMSORT_H
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <functional>
+#include <utility>
+
+
+// Timsort as in CPython and OpenJDK, the reference for the benchmarks: natural runs are extended to a minimum
+// length by binary insertion sort and merged on a stack whose run lengths keep the invariants of the corrected
+// merge_collapse. The merges switch to galloping when one side wins repeatedly.
+
+const size_t kTimMinMerge =     64;         // inputs below this are sorted by binary insertion
+const size_t kTimMinGallop =    7;          // initial number of consecutive wins before galloping
+
+
+template <class RAI, class Compare = std::less<typename std::iterator_traits<RAI>::value_type>>
+class TimSorting {
+public:
+    typedef typename std::iterator_traits<RAI>::value_type  ValueType;
+
+    explicit TimSorting(Compare comp = Compare()) : comp_(comp) { }
+
+    TimSorting(const TimSorting&) =             delete;
+    TimSorting& operator=(const TimSorting&) =  delete;
+
+
+    void Sort(RAI begin, RAI end) {
+        const size_t num_elements = std::distance(begin, end);
+        if (num_elements < 2) {
+            return;
+        }
+        data_ = begin;
+        stack_.clear();
+        min_gallop_ = kTimMinGallop;
+        if (num_elements < kTimMinMerge) {
+            BinaryInsertionSort(0, num_elements, CountRunAndMakeAscending(0, num_elements));
+            return;
+        }
+
+        const size_t min_run = MinRunLength(num_elements);
+        size_t lo = 0;
+        while (lo < num_elements) {
+            size_t run = CountRunAndMakeAscending(lo, num_elements);
+            if (run < min_run) {
+                const size_t forced = std::min(min_run, num_elements - lo);
+                BinaryInsertionSort(lo, lo + forced, lo + run);
+                run = forced;
+            }
+            stack_.push_back(Run{lo, run});
+            MergeCollapse();
+            lo += run;
+        }
+        while (stack_.size() > 1) {
+            size_t n = stack_.size() - 2;
+            if (n > 0 && stack_[n - 1].size < stack_[n + 1].size) {
+                n--;
+            }
+            MergeAt(n);
+        }
+    }
+
+
+private:
+    struct Run {
+        size_t begin, size;
+    };
+
+    Compare comp_;
+    RAI data_;
+    std::vector<Run> stack_;
+    std::vector<ValueType> buffer_;
+    size_t min_gallop_ = kTimMinGallop;
+
+    // n itself if it is small, otherwise a length between 32 and 64 such that n / length is close to a power of 2
+    static size_t MinRunLength(size_t n) {
+        size_t r = 0;
+        while (n >= kTimMinMerge) {
+            r |= n & 1;
+            n >>= 1;
+        }
+        return n + r;
+    }
+
+    // length of the run that starts at lo, a strictly descending run is reversed
+    size_t CountRunAndMakeAscending(size_t lo, size_t hi) {
+        size_t run_hi = lo + 1;
+        if (run_hi == hi) {
+            return 1;
+        }
+        if (comp_(data_[run_hi], data_[lo])) {
+            while (run_hi < hi && comp_(data_[run_hi], data_[run_hi - 1])) {
+                run_hi++;
+            }
+            std::reverse(data_ + lo, data_ + run_hi);
+        } else {
+            while (run_hi < hi && !comp_(data_[run_hi], data_[run_hi - 1])) {
+                run_hi++;
+            }
+        }
+        return run_hi - lo;
+    }
+
+    // [lo, start) is sorted, insert the elements of [start, hi) behind their equals
+    void BinaryInsertionSort(size_t lo, size_t hi, size_t start) {
+        for (; start < hi; start++) {
+            ValueType pivot = std::move(data_[start]);
+            RAI pos = std::upper_bound(data_ + lo, data_ + start, pivot, comp_);
+            std::move_backward(pos, data_ + start, data_ + start + 1);
+            *pos = std::move(pivot);
+        }
+    }
+
+    void MergeCollapse() {
+        while (stack_.size() > 1) {
+            size_t n = stack_.size() - 2;
+            if ((n > 0 && stack_[n - 1].size <= stack_[n].size + stack_[n + 1].size)
+                || (n > 1 && stack_[n - 2].size <= stack_[n - 1].size + stack_[n].size)) {
+                if (stack_[n - 1].size < stack_[n + 1].size) {
+                    n--;
+                }
+            } else if (stack_[n].size > stack_[n + 1].size) {
+                return;
+            }
+            MergeAt(n);
+        }
+    }
+
+    // Position of key in the sorted range [a, a + size) in front of its equals, the search gallops from hint
+    template <class It>
+    size_t GallopLeft(const ValueType& key, It a, size_t size, size_t hint) {
+        size_t last_ofs = 0;
+        size_t ofs = 1;
+        if (comp_(a[hint], key)) {
+            const size_t max_ofs = size - hint;
+            while (ofs < max_ofs && comp_(a[hint + ofs], key)) {
+                last_ofs = ofs;
+                ofs = 2 * ofs + 1;
+            }
+            ofs = std::min(ofs, max_ofs);
+            return std::lower_bound(a + hint + last_ofs + 1, a + hint + ofs, key, comp_) - a;
+        }
+        const size_t max_ofs = hint + 1;
+        while (ofs < max_ofs && !comp_(a[hint - ofs], key)) {
+            last_ofs = ofs;
+            ofs = 2 * ofs + 1;
+        }
+        ofs = std::min(ofs, max_ofs);
+        return std::lower_bound(a + (hint + 1 - ofs), a + (hint - last_ofs), key, comp_) - a;
+    }
+
+    // Position of key in the sorted range [a, a + size) behind its equals
+    template <class It>
+    size_t GallopRight(const ValueType& key, It a, size_t size, size_t hint) {
+        size_t last_ofs = 0;
+        size_t ofs = 1;
+        if (comp_(key, a[hint])) {
+            const size_t max_ofs = hint + 1;
+            while (ofs < max_ofs && comp_(key, a[hint - ofs])) {
+                last_ofs = ofs;
+                ofs = 2 * ofs + 1;
+            }
+            ofs = std::min(ofs, max_ofs);
+            return std::upper_bound(a + (hint + 1 - ofs), a + (hint - last_ofs), key, comp_) - a;
+        }
+        const size_t max_ofs = size - hint;
+        while (ofs < max_ofs && !comp_(key, a[hint + ofs])) {
+            last_ofs = ofs;
+            ofs = 2 * ofs + 1;
+        }
+        ofs = std::min(ofs, max_ofs);
+        return std::upper_bound(a + hint + last_ofs + 1, a + hint + ofs, key, comp_) - a;
+    }
+
+    // merge the runs i and i + 1 of the stack
+    void MergeAt(size_t i) {
+        size_t begin1 = stack_[i].begin;
+        size_t size1 = stack_[i].size;
+        const size_t begin2 = stack_[i + 1].begin;
+        size_t size2 = stack_[i + 1].size;
+        stack_[i].size = size1 + size2;
+        stack_.erase(stack_.begin() + i + 1);
+
+        // elements of the first run that are not greater than the head of the second one are in place already,
+        // the same holds for the elements of the second run that are not less than the last of the first one
+        const size_t k = GallopRight(data_[begin2], data_ + begin1, size1, 0);
+        begin1 += k;
+        size1 -= k;
+        if (size1 == 0) {
+            return;
+        }
+        size2 = GallopLeft(data_[begin1 + size1 - 1], data_ + begin2, size2, size2 - 1);
+        if (size2 == 0) {
+            return;
+        }
+        if (size1 <= size2) {
+            MergeLo(begin1, size1, begin2, size2);
+        } else {
+            MergeHi(begin1, size1, begin2, size2);
+        }
+    }
+
+    // Merge from the front with the first run in the buffer, it is the shorter one
+    void MergeLo(size_t begin1, size_t size1, size_t begin2, size_t size2) {
+        buffer_.assign(std::make_move_iterator(data_ + begin1), std::make_move_iterator(data_ + begin1 + size1));
+        typename std::vector<ValueType>::iterator tmp = buffer_.begin();
+        size_t cursor1 = 0;
+        size_t cursor2 = begin2;
+        size_t dest = begin1;
+        const size_t end2 = begin2 + size2;
+
+        while (cursor1 < size1 && cursor2 < end2) {
+            size_t count1 = 0;
+            size_t count2 = 0;
+            while (cursor1 < size1 && cursor2 < end2 && std::max(count1, count2) < min_gallop_) {
+                if (comp_(data_[cursor2], tmp[cursor1])) {
+                    data_[dest++] = std::move(data_[cursor2++]);
+                    count2++;
+                    count1 = 0;
+                } else {
+                    data_[dest++] = std::move(tmp[cursor1++]);
+                    count1++;
+                    count2 = 0;
+                }
+            }
+
+            // galloping: move whole stretches that win against the head of the other run
+            while (cursor1 < size1 && cursor2 < end2) {
+                count1 = GallopRight(data_[cursor2], tmp + cursor1, size1 - cursor1, 0);
+                std::move(tmp + cursor1, tmp + cursor1 + count1, data_ + dest);
+                dest += count1;
+                cursor1 += count1;
+                if (cursor1 == size1) {
+                    break;
+                }
+                data_[dest++] = std::move(data_[cursor2++]);
+                if (cursor2 == end2) {
+                    break;
+                }
+                count2 = GallopLeft(tmp[cursor1], data_ + cursor2, end2 - cursor2, 0);
+                std::move(data_ + cursor2, data_ + cursor2 + count2, data_ + dest);
+                dest += count2;
+                cursor2 += count2;
+                if (cursor2 == end2) {
+                    break;
+                }
+                data_[dest++] = std::move(tmp[cursor1++]);
+                min_gallop_ -= min_gallop_ > 1;
+                if (count1 < kTimMinGallop && count2 < kTimMinGallop) {
+                    min_gallop_ += 2;
+                    break;
+                }
+            }
+        }
+        std::move(tmp + cursor1, tmp + size1, data_ + dest);
+    }
+
+    // Merge from the back with the second run in the buffer, it is the shorter one
+    void MergeHi(size_t begin1, size_t size1, size_t begin2, size_t size2) {
+        buffer_.assign(std::make_move_iterator(data_ + begin2), std::make_move_iterator(data_ + begin2 + size2));
+        typename std::vector<ValueType>::iterator tmp = buffer_.begin();
+        size_t cursor1 = begin1 + size1;        // behind the next element of each run
+        size_t cursor2 = size2;
+        size_t dest = begin2 + size2;
+
+        while (cursor1 > begin1 && cursor2 > 0) {
+            size_t count1 = 0;
+            size_t count2 = 0;
+            while (cursor1 > begin1 && cursor2 > 0 && std::max(count1, count2) < min_gallop_) {
+                if (comp_(tmp[cursor2 - 1], data_[cursor1 - 1])) {
+                    data_[--dest] = std::move(data_[--cursor1]);
+                    count1++;
+                    count2 = 0;
+                } else {
+                    data_[--dest] = std::move(tmp[--cursor2]);
+                    count2++;
+                    count1 = 0;
+                }
+            }
+
+            while (cursor1 > begin1 && cursor2 > 0) {
+                const size_t size_left1 = cursor1 - begin1;
+                count1 = size_left1 - GallopRight(tmp[cursor2 - 1], data_ + begin1, size_left1, size_left1 - 1);
+                std::move_backward(data_ + cursor1 - count1, data_ + cursor1, data_ + dest);
+                dest -= count1;
+                cursor1 -= count1;
+                if (cursor1 == begin1) {
+                    break;
+                }
+                data_[--dest] = std::move(tmp[--cursor2]);
+                if (cursor2 == 0) {
+                    break;
+                }
+                count2 = cursor2 - GallopLeft(data_[cursor1 - 1], tmp, cursor2, cursor2 - 1);
+                std::move_backward(tmp + cursor2 - count2, tmp + cursor2, data_ + dest);
+                dest -= count2;
+                cursor2 -= count2;
+                if (cursor2 == 0) {
+                    break;
+                }
+                data_[--dest] = std::move(data_[--cursor1]);
+                min_gallop_ -= min_gallop_ > 1;
+                if (count1 < kTimMinGallop && count2 < kTimMinGallop) {
+                    min_gallop_ += 2;
+                    break;
+                }
+            }
+        }
+        std::move_backward(tmp, tmp + cursor2, data_ + dest);
+    }
+};
+
+
+template <class RAI, class Compare>
+void TimSortFunc(RAI begin, RAI end, Compare comp) {
+    TimSorting<RAI, Compare> sorter(comp);
+    sorter.Sort(begin, end);
+}
+
+template <class RAI>
+void TimSortFunc(RAI begin, RAI end) {
+    TimSorting<RAI> sorter;
+    sorter.Sort(begin, end);
+}
+
+#endif
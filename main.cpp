@@ -1,11 +1,212 @@
 #include <iostream>
 #include <random>
 #include <chrono>
+#include <thread>
+#include <atomic>
 #include "PatienceSort.h"
+#include "PatienceSorter.h"
+#include "ExternalSort.h"
 
 using namespace std;
 
 
+// Sorts independent batches on several threads at the same time and checks every result against std::sort
+bool ConcurrentSortCheck(int num_threads, int batches_per_thread) {
+    std::atomic<int> failures(0);
+    vector<thread> threads;
+
+    for(int t = 0; t < num_threads; t++) {
+        threads.push_back(thread([t, batches_per_thread, &failures]() {
+            std::mt19937 mt(t);
+            std::uniform_int_distribution<int> dist_size(0, 200000);
+
+            for(int b = 0; b < batches_per_thread; b++) {
+                const int size = dist_size(mt);
+                std::uniform_int_distribution<int> dist_pos(0, std::max(size - 1, 0));
+                vector<int> values(size), ref;
+                for(int i = 0; i < size; i++) {
+                    values[i] = i;
+                }
+                for(int i = 0; i < size / 10; i++) {
+                    values[dist_pos(mt)] = dist_pos(mt);
+                }
+                ref = values;
+
+                sort(ref.begin(), ref.end());
+                PatienceSortFunc(values.begin(), values.end());
+                if(values != ref) {
+                    failures++;
+                }
+            }
+        }));
+    }
+    for(auto& th : threads) {
+        th.join();
+    }
+    return failures == 0;
+}
+
+// Sorts timestamps with the index of their record as payload and checks that equal timestamps keep their order
+bool KeyValueSortCheck(const vector<int>& timestamps) {
+    vector<int> keys = timestamps;
+    vector<size_t> payload(keys.size());
+    vector<pair<int, size_t>> ref(keys.size());
+    for(size_t i = 0; i < keys.size(); i++) {
+        payload[i] = i;
+        ref[i] = make_pair(keys[i], i);
+    }
+    stable_sort(ref.begin(), ref.end(), [](const pair<int, size_t>& a, const pair<int, size_t>& b) { return a.first < b.first; });
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    PatienceSortKeyValue(keys.begin(), keys.end(), payload.begin());
+    auto t1 = std::chrono::high_resolution_clock::now();
+    cout << "Patience Sort (key-value):\t" << chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << " ms" << endl;
+
+    for(size_t i = 0; i < keys.size(); i++) {
+        if(keys[i] != ref[i].first || payload[i] != ref[i].second) {
+            return false;
+        }
+    }
+    return true;
+}
+// Pushes almost ordered event times in batches to a PatienceSorter and drains everything below the watermark
+// after every batch, the concatenated output has to be sorted
+bool StreamingSortCheck(int count, int batch_size, int max_delay) {
+    std::mt19937 mt(count);
+    std::uniform_int_distribution<int> dist_delay(0, max_delay);
+    vector<int> events(count);
+    for(int i = 0; i < count; i++) {
+        events[i] = i - dist_delay(mt);
+    }
+
+    PatienceSorter<int> sorter;
+    vector<int> sorted;
+    sorted.reserve(count);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < count; i += batch_size) {
+        const int batch_end = std::min(count, i + batch_size);
+        sorter.Push(events.begin() + i, events.begin() + batch_end);
+        sorter.DrainBelow(batch_end - max_delay, back_inserter(sorted));
+    }
+    sorter.DrainSorted(back_inserter(sorted));
+    auto t1 = std::chrono::high_resolution_clock::now();
+    cout << "Patience Sort (streaming):\t" << chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << " ms" << endl;
+
+    sort(events.begin(), events.end());
+    return sorted == events && sorter.LateElements() == 0;
+}
+// Sorts a file of 64 bit log offsets with num_randoms random ones that is several times larger than the memory
+// budget, checks the output file against std::sort and the memory of the chunks against the budget
+bool ExternalSortCheck(size_t count, size_t memory_budget, size_t fan_in, size_t num_randoms) {
+    const std::string input_path = "external_sort_input.bin";
+    const std::string output_path = "external_sort_output.bin";
+    std::mt19937_64 mt(count);
+    std::uniform_int_distribution<uint64_t> dist_pos(0, count - 1);
+    vector<uint64_t> offsets(count);
+    for(size_t i = 0; i < count; i++) {
+        offsets[i] = i * 64;
+    }
+    for(size_t i = 0; i < num_randoms; i++) {
+        offsets[dist_pos(mt)] = dist_pos(mt) * 64;
+    }
+    FILE* file = fopen(input_path.c_str(), "wb");
+    bool ok = file != NULL && fwrite(offsets.data(), sizeof(uint64_t), count, file) == count;
+    ok = file != NULL && fclose(file) == 0 && ok;
+
+    ExternalPatienceSorting<uint64_t> sorter(memory_budget);
+    sorter.SetFanIn(fan_in);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    ok = ok && sorter.Sort(input_path, output_path);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    const ExternalSortStats& stats = sorter.Stats();
+    cout << "Patience Sort (external, " << count * sizeof(uint64_t) / memory_budget << "x the memory budget):\t"
+         << chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << " ms, " << stats.spilled_runs
+         << " spilled runs, " << stats.passes << " passes, " << stats.bytes_read << " bytes read, "
+         << stats.bytes_written << " bytes written, " << stats.peak_bytes << " bytes peak memory" << endl;
+    ok = ok && stats.peak_bytes <= memory_budget;
+
+    MappedFile output;
+    ok = ok && output.MapRead(output_path) && output.size() == count * sizeof(uint64_t);
+    sort(offsets.begin(), offsets.end());
+    ok = ok && std::equal(offsets.begin(), offsets.end(), reinterpret_cast<const uint64_t*>(output.data()));
+    output.Unmap();
+    remove(input_path.c_str());
+    remove(output_path.c_str());
+    return ok;
+}
+
+// PartialSort() and NthElement() of random input, which go to std::partial_sort and std::nth_element, after a full
+// sort of a larger almost sorted input. The results are checked against std::sort, LastStats() has to describe the
+// last call and the high-water mark has to free the memory the full sort left.
+bool PartialSortCheck(int count, int k) {
+    std::mt19937 mt(count);
+    std::uniform_int_distribution<int> dist_value;
+    vector<int> almost_sorted(2 * count), random(count);
+    for(int i = 0; i < 2 * count; i++) {
+        almost_sorted[i] = i % 1000 == 0 ? dist_value(mt) : i;
+    }
+    for(int i = 0; i < count; i++) {
+        random[i] = dist_value(mt);
+    }
+    vector<int> ref = random;
+    sort(ref.begin(), ref.end());
+
+    PatienceSorting<vector<int>::iterator, std::less<int>, DefaultBlockSize<int>::value, SortStats> sorter;
+    bool ok = true;
+    for(int variant = 0; variant < 2; variant++) {
+        vector<int> values = almost_sorted;
+        sorter.SetHighWaterMark(0);
+        sorter.Sort(values.begin(), values.end());
+        ok = ok && sorter.RetainedBytes() > 0;
+
+        values = random;
+        sorter.SetHighWaterMark(1);
+        if(variant == 0) {
+            sorter.PartialSort(values.begin(), values.begin() + k, values.end());
+            ok = ok && std::equal(ref.begin(), ref.begin() + k, values.begin());
+        } else {
+            sorter.NthElement(values.begin(), values.begin() + k, values.end());
+            ok = ok && values[k] == ref[k]
+                 && std::all_of(values.begin(), values.begin() + k, [&](int v) { return v <= ref[k]; })
+                 && std::all_of(values.begin() + k, values.end(), [&](int v) { return v >= ref[k]; });
+        }
+        const SortStats& stats = sorter.LastStats();
+        ok = ok && stats.num_elements == static_cast<size_t>(count) && stats.strategy == sorter.Strategy()
+             && stats.fallback && stats.total_ns >= stats.phase_ns[kPhaseFallback] && stats.phase_ns[kPhaseFallback] > 0
+             && sorter.RetainedBytes() == 0;
+    }
+    return ok;
+}
+
+// Times std::sort and Patience Sort on uniformly random keys, for which Patience Sort falls back to its radix sort
+template <typename T, class Distribution>
+bool RandomSortBench(const char* name, Distribution dist, int count, int rounds) {
+    std::mt19937 mt(count);
+    vector<T> values(count);
+    for(int i = 0; i < count; i++) {
+        values[i] = dist(mt);
+    }
+
+    float ref_result = 0;
+    float ps_result = 0;
+    bool ok = true;
+    for(int i = 0; i < rounds; i++) {
+        vector<T> values_ref = values;
+        vector<T> values_ps = values;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        sort(values_ref.begin(), values_ref.end());
+        auto t1 = std::chrono::high_resolution_clock::now();
+        PatienceSortFunc(values_ps.begin(), values_ps.end());
+        auto t2 = std::chrono::high_resolution_clock::now();
+        ref_result += chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+        ps_result += chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        ok = ok && values_ps == values_ref;
+    }
+    cout << "Random " << name << ": std::sort " << ref_result / rounds << " ms, Patience Sort (radix) "
+         << ps_result / rounds << " ms" << (ok ? "" : " FAILED") << endl;
+    return ok;
+}
+
 
 int main() {
 
@@ -20,8 +221,7 @@ int main() {
     float ps_result = 0;
     int num_randoms;
 
-    std::random_device dev;
-    std::mt19937 mt(dev());
+    std::mt19937 mt(count);                 // fixed seed, SortBench covers more inputs and sizes
     std::uniform_int_distribution<int> dist_value(0, max_value);
     std::uniform_int_distribution<int> dist_rand(0, count);
 
@@ -49,8 +249,8 @@ int main() {
         auto t2 = std::chrono::high_resolution_clock::now();
 
 
-        ref_results.push_back(chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count());
-        ps_results.push_back(chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count());
+        ref_results.push_back(chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / 1000.0f);
+        ps_results.push_back(chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1000.0f);
 
     }
 
@@ -63,6 +263,68 @@ int main() {
     cout << "std::sort:\t" << ref_result << " ms" << endl;
     cout << "Patience Sort:\t" << ps_result << " ms" << endl;
 
+    // the disorder probe of the benchmark input and the strategy it leads to
+    const char* strategy_names[] = { "auto", "patience sort", "natural merge", "fallback", "radix", "small" };
+    PatienceSorting<vector<int>::iterator> probed;
+    vector<int> values_probed = ps;
+    probed.Sort(values_probed.begin(), values_probed.end());
+    cout << "Probe: descents " << probed.Probe().descents << ", runs " << probed.Probe().runs
+         << ", inversions " << probed.Probe().inversions << ", longest run " << probed.Probe().longest_run
+         << " -> " << strategy_names[probed.Strategy()] << endl;
+
+    PatienceSorting<vector<int>::iterator, std::less<int>, DefaultBlockSize<int>::value, SortStats> instrumented;
+    values_probed = ps;
+    cout << "Stats: " << instrumented.Sort(values_probed.begin(), values_probed.end()) << endl;
+
+    StrategyThresholds thresholds = CalibrateStrategy();
+    cout << "Calibrated thresholds: descents " << thresholds.max_descents << ", inversions " << thresholds.max_inversions
+         << ", natural merge descents " << thresholds.max_natural_descents << ", natural merge runs "
+         << thresholds.max_natural_runs << endl;
+
+    // scale the parallel run generation and merge phase up to all cores, at least 2 threads also on a single core
+    vector<int> sorted_ref = ps;
+    sort(sorted_ref.begin(), sorted_ref.end());
+    bool parallel_ok = true;
+    for(unsigned threads = 2; threads <= std::max(2u, thread::hardware_concurrency()); threads *= 2) {
+        float par_result = 0;
+        bool ok = true;
+        for(int i = 0; i < rounds; i++) {
+            vector<int> values_par = ps;
+            auto t0 = std::chrono::high_resolution_clock::now();
+            ParallelPatienceSortFunc(values_par.begin(), values_par.end(), threads);
+            auto t1 = std::chrono::high_resolution_clock::now();
+            par_result += chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+            ok = ok && values_par == sorted_ref;
+        }
+        cout << "Patience Sort (" << threads << " threads):\t" << par_result / rounds << " ms" << (ok ? "" : " FAILED") << endl;
+        parallel_ok = parallel_ok && ok;
+    }
+
+
+    bool random_ok = RandomSortBench<int>("int", std::uniform_int_distribution<int>(), count, 3);
+    random_ok = RandomSortBench<uint64_t>("uint64_t", std::uniform_int_distribution<uint64_t>(), count, 3) && random_ok;
+    random_ok = RandomSortBench<double>("double", std::normal_distribution<double>(), count, 3) && random_ok;
+
+    bool partial_ok = PartialSortCheck(count / 20, 1000);
+    cout << "Partial sort and nth element of random input: " << (partial_ok ? "OK" : "FAILED") << endl;
+
+    bool key_value_ok = KeyValueSortCheck(ps);
+    cout << "Stable key-value sorting: " << (key_value_ok ? "OK" : "FAILED") << endl;
+
+    bool streaming_ok = StreamingSortCheck(count, 100000, 1000);
+    cout << "Streaming sorting with watermarks: " << (streaming_ok ? "OK" : "FAILED") << endl;
+
+    // 1% random offsets, random offsets in a 1 MiB budget and rare random offsets that leave the chunks to patience sort
+    bool external_ok = ExternalSortCheck(count, count * sizeof(uint64_t) / 8, 4, count / 100);
+    external_ok = ExternalSortCheck(count / 10, 1 << 20, 16, count / 10) && external_ok;
+    external_ok = ExternalSortCheck(count, count * sizeof(uint64_t) / 8, 4, count / 100000) && external_ok;
+    cout << "External sorting: " << (external_ok ? "OK" : "FAILED") << endl;
+
+    const int num_threads = std::max(8, static_cast<int>(thread::hardware_concurrency()));
+    const int batches_per_thread = 20;
+    bool concurrent_ok = ConcurrentSortCheck(num_threads, batches_per_thread);
+    cout << "Concurrent sorting of " << num_threads * batches_per_thread << " batches on " << num_threads
+         << " threads: " << (concurrent_ok ? "OK" : "FAILED") << endl;
 
-    return 0;
+    return concurrent_ok && partial_ok && key_value_ok && random_ok && streaming_ok && external_ok && parallel_ok ? 0 : 1;
 }